@@ -379,17 +379,29 @@ void graph(struct dbx *d)
 		draw_vec(d, &vs[i], t);
 }
 
+/* the vectors move every frame, the grid only with the view */
 static int update(struct dbx *d)
 {
-	dbx_blank_pixmap(d);
+	static struct state drawn = { .scale = -1.0f };
 
 	update_state();
 
-	draw_grid(d);
+	if (memcmp(&state, &drawn, sizeof(state))) {
+		dbx_layer_dirty(d, DBX_LAYER_BG);
+		drawn = state;
+	}
+	dbx_layer_dirty(d, DBX_LAYER_MAIN);
+	if (dbx_dirty(d))
+		dbx_layer_dirty(d, DBX_LAYER_HUD);
+
+	if (dbx_layer(d, DBX_LAYER_BG))
+		draw_grid(d);
 
-	graph(d);
+	if (dbx_layer(d, DBX_LAYER_MAIN))
+		graph(d);
 
-	mouse_coord(d);
+	if (dbx_layer(d, DBX_LAYER_HUD))
+		mouse_coord(d);
 	return 0;
 }
 
@@ -8,6 +8,7 @@
 #include <math.h>
 #include <time.h>
 
+#include "approx.h"
 #include "dbx.h"
 
 
@@ -165,24 +166,26 @@ void update_state(void)
 #define GDELT	2.0f
 #endif
 
+/* per pixel, so squared distances and approx.h rather than libm */
 u32 ground_clr(struct line *l, float x, float y)
 {
-
-	float d = GSCL / sqrt(pow(x - l->p.x[0], 2) + pow(y - l->p.x[1], 2));
+	float dx = x - l->p.x[0], dy = y - l->p.x[1];
+	float r2 = dx * dx + dy * dy;
 	float gmod = GMOD;
+	float d;
 
-	if (d > 1.0f)
-		d = 1.0f;
-
-	if (sqrt(pow(x, 2) + pow(y, 2)) < 700.0f)
+	if (x * x + y * y < 700.0f * 700.0f)
 		return 0x400000;
+
+	/* GSCL / distance, no more than 1 */
+	d = r2 > GSCL * GSCL ? GSCL * approx_rsqrt(r2) : 1.0f;
 	//if (!float_cmp(d, 0.001))
 	//printf("%4.3f\n", d);
 	//for (i = 0.0f; i < d; i += 0.01f)
 	//	gmod += 0.1f;
 
-	x = fmod(x, gmod);
-	y = fmod(y, gmod);
+	x = approx_fmod(x, gmod);
+	y = approx_fmod(y, gmod);
 
 	if (float_cmp(x, GDELT))
 		return GNCLR + (((u32)(GDCLR * d) & 0xff) << GSHFT);
@@ -220,13 +223,16 @@ void ray_trace(struct dbx *d)
 	int x, y;
 	float xi, yi;
 	struct line l = { .p = state.p };
+	u32 *fb = dbx_framebuffer(d);
+	int stride = dbx_stride(d);
+	u32 clr;
 	int ret;
 
 	ys = yva / ht;
 	xs = xva / wd;
 
-	ya = -1.0f * yva / 2.0f;
-	for (y = ht; y >= 0; y--, ya += ys) {
+	ya = -1.0f * yva / 2.0f + ys;
+	for (y = ht - 1; y >= 0; y--, ya += ys) {
 		xa = -1.0f * xva / 2.0f;
 		for (x = 0; x < wd; x++, xa += xs) {
 			angle2vector(&l.d, state.theta + xa, state.phi + ya, 1);
@@ -241,10 +247,15 @@ void ray_trace(struct dbx *d)
 			if (ret <= 0) {
 				if (ret < 0)
 					printf("%d %d %d\n", x, y, x * y);
-				dbx_draw_point(d, x, y, 0);
+				clr = 0;
 			}
 			else
-				dbx_draw_point(d, x, y, ground_clr(&l, xi, yi));
+				clr = ground_clr(&l, xi, yi);
+
+			if (fb)
+				fb[y * stride + x] = clr;
+			else
+				dbx_draw_point(d, x, y, clr);
 		}
 	}
 
@@ -256,6 +267,10 @@ void ray_trace(struct dbx *d)
 
 static int update(struct dbx *d)
 {
+	if (!dbx_dirty(d) && !up && !down && !left && !right &&
+	    !fwd && !rev && !hi && !lo)
+		return DBX_IDLE;
+
 	dbx_blank_pixmap(d);
 	update_state();
 	ray_trace(d);
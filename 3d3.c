@@ -115,7 +115,8 @@ void ray_trace(struct dbx *d)
 	float yva = viewing_angle(y_aper, 1.9f);
 	float xs = xva / wd;
 	float ys = yva / ht;
-	int i;
+	u32 *fb;
+	int i, stride;
 	//u64 us;
 
 	if (!dat) {
@@ -149,8 +150,14 @@ void ray_trace(struct dbx *d)
 		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
 
 	//us = tickcount_us();
-	for (i = 0; i < wd * ht; i++)
-		dbx_draw_point(d, i % wd, i / wd, dat[i]);
+	fb = dbx_framebuffer(d);
+	stride = dbx_stride(d);
+	if (fb)
+		for (i = 0; i < ht; i++)
+			memcpy(&fb[i * stride], &dat[i * wd], wd * sizeof(*dat));
+	else
+		for (i = 0; i < wd * ht; i++)
+			dbx_draw_point(d, i % wd, i / wd, dat[i]);
 	//us = tickcount_us() - us;
 	//printf("%" PRIu64 " us  (%u, %u)\n", us, wd, ht);
 
@@ -162,6 +169,10 @@ void ray_trace(struct dbx *d)
 
 static int update(struct dbx *d)
 {
+	if (!dbx_dirty(d) && !up && !down && !left && !right &&
+	    !fwd && !rev && !hi && !lo)
+		return DBX_IDLE;
+
 	dbx_blank_pixmap(d);
 	update_state();
 	ray_trace(d);
@@ -187,21 +198,52 @@ static int key(struct dbx *d, int code, int key, int press)
 	return key != 'q' ? 0 : (press ? -1 : 0);
 }
 
+/* name in the directory path is in */
+char *beside(const char *path, const char *name)
+{
+	const char *slash = strrchr(path, '/');
+	int dir = slash ? slash - path + 1 : 0;
+	char *s = malloc(dir + strlen(name) + 1);
+
+	if (!s) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		return NULL;
+	}
+	memcpy(s, path, dir);
+	strcpy(s + dir, name);
+	return s;
+}
+
 #define UPDATE_PERIOD_MS	30
 int main(int argc, char *argv[])
 {
 	struct dbx_ops ops = { .update = update, .key = key, };
-	const char *kernel;
+	/* the kernel can use anything in approx.h, kept next to it */
+	const char *src[2];
+	char *approx;
+
+	if (argc < 2) {
+		printf("usage: %s kernel.c\n", argv[0]);
+		return EXIT_FAILURE;
+	}
 
-	kernel = loadfile(argv[1]);
-	if (!kernel) {
+	approx = beside(argv[1], "approx.h");
+	if (!approx)
+		return EXIT_FAILURE;
+	src[0] = loadfile(approx);
+	src[1] = loadfile(argv[1]);
+	free(approx);
+	if (!src[0] || !src[1]) {
+		free((char *)src[0]);
+		free((char *)src[1]);
 		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
 		return EXIT_FAILURE;
 	}
 
-	dbcl = dbcl_open(&kernel);
+	dbcl = dbcl_open(src, ARRAY_SIZE(src));
 	if (!dbcl) {
-		free((char *)kernel);
+		free((char *)src[0]);
+		free((char *)src[1]);
 		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
 		return EXIT_FAILURE;
 	}
@@ -209,7 +251,8 @@ int main(int argc, char *argv[])
 	dbx_run(argc, argv, &ops, UPDATE_PERIOD_MS);
 
 	dbcl_close(dbcl);
-	free((char *)kernel);
+	free((char *)src[0]);
+	free((char *)src[1]);
 
 	return EXIT_SUCCESS;
 }
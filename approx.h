@@ -0,0 +1,236 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+/*
+ * Fast float approximations: range reduction, then a polynomial in Horner
+ * form over compile time coefficients. Plain C that also builds as OpenCL C,
+ * 3d3 hands this file to the compiler ahead of the kernel source.
+ *
+ * Worst errors seen against double precision:
+ *
+ *   approx_sin, approx_cos   |x| < 8192              8e-8 absolute
+ *   approx_exp2              -126 < x < 128          1.1e-7 relative
+ *   approx_log2              x > 0, not denormal     2e-7 absolute
+ *   approx_pow               x > 0, |y log2 x| < 16  2.4e-6 relative
+ *                            integer |y| <= 64 by squaring, any x
+ *   approx_rsqrt             x > 0, not denormal     4.8e-6 relative
+ *   approx_fmod              |x / m| < 2^23          x - m * trunc(x / m)
+ *   approx_taylor_sin        the series itself, terms stop at x^33 / 33!
+ */
+
+#ifdef __OPENCL_VERSION__
+#define APPROX_FN
+#define APPROX_CONST		__constant
+#define approx_as_int(f)	as_int(f)
+#define approx_as_float(i)	as_float(i)
+#else
+#define APPROX_FN		static inline
+#define APPROX_CONST		static const
+
+APPROX_FN int approx_as_int(float f)
+{
+	union { float f; int i; } u = { .f = f };
+
+	return u.i;
+}
+
+APPROX_FN float approx_as_float(int i)
+{
+	union { float f; int i; } u = { .i = i };
+
+	return u.f;
+}
+#endif
+
+#define APPROX_INF	approx_as_float(0x7f800000)
+#define APPROX_NAN	approx_as_float(0x7fc00000)
+
+/******************************************************************************/
+
+/*
+ * sin and cos as in the Cephes sinf: x reduced to [-pi/4, pi/4] by pi/4 in
+ * three parts (Cody-Waite), then a minimax polynomial for either one.
+ * Past APPROX_SC_MAX the reduction runs out of bits.
+ */
+
+#define APPROX_FOPI	1.27323954473516f	/* 4 / pi */
+#define APPROX_DP1	0.78515625f
+#define APPROX_DP2	2.4187564849853515625e-4f
+#define APPROX_DP3	3.77489497744594108e-8f
+#define APPROX_SC_MAX	8192.0f
+
+#define APPROX_S0	-1.9515295891e-4f
+#define APPROX_S1	 8.3321608736e-3f
+#define APPROX_S2	-1.6666654611e-1f
+#define APPROX_C0	 2.443315711809948e-5f
+#define APPROX_C1	-1.388731625493765e-3f
+#define APPROX_C2	 4.166664568298827e-2f
+
+APPROX_FN float approx_sincos(float x, int c)
+{
+	float ax = x < 0.0f ? -x : x, z, y;
+	int j, neg = x < 0.0f && !c;
+
+	/* even octants only, r ends up within pi/4 of one */
+	j = (int)(ax * APPROX_FOPI);
+	j += j & 1;
+	y = (float)j;
+	ax = ((ax - y * APPROX_DP1) - y * APPROX_DP2) - y * APPROX_DP3;
+
+	/* cos(x) = sin(|x| + pi/2), two octants on */
+	j = (j + 2 * c) & 7;
+	if (j > 3) {
+		neg = !neg;
+		j -= 4;
+	}
+
+	z = ax * ax;
+	if (j)
+		y = ((APPROX_C0 * z + APPROX_C1) * z + APPROX_C2) * z * z -
+		    0.5f * z + 1.0f;
+	else
+		y = ((APPROX_S0 * z + APPROX_S1) * z + APPROX_S2) * z * ax + ax;
+
+	return neg ? -y : y;
+}
+
+APPROX_FN float approx_sin(float x) { return approx_sincos(x, 0); }
+APPROX_FN float approx_cos(float x) { return approx_sincos(x, 1); }
+
+/******************************************************************************/
+
+/*
+ * exp2 splits x into the nearest integer, which goes straight into the
+ * exponent bits, and f in [-1/2, 1/2]; log2 splits x into its exponent and
+ * m in [sqrt(1/2), sqrt(2)] and works on t = (m - 1) / (m + 1), where
+ * log2(m) = t * P(t^2). Both polynomials are Chebyshev fits over those
+ * ranges in monomial form.
+ */
+
+#define APPROX_E0	1.000000000e+00f
+#define APPROX_E1	6.931472067e-01f
+#define APPROX_E2	2.402265121e-01f
+#define APPROX_E3	5.550327214e-02f
+#define APPROX_E4	9.618025603e-03f
+#define APPROX_E5	1.340043217e-03f
+#define APPROX_E6	1.546973193e-04f
+
+#define APPROX_L0	2.885390080e+00f
+#define APPROX_L1	9.617988462e-01f
+#define APPROX_L2	5.767145103e-01f
+#define APPROX_L3	4.317330173e-01f
+
+#define APPROX_SQRT2	1.41421356237f
+#define APPROX_POWI_MAX	64	/* beyond this squaring isn't the cheap way */
+
+APPROX_FN float approx_exp2(float x)
+{
+	float f, p;
+	int i;
+
+	if (x < -126.0f)
+		return 0.0f;
+	if (x >= 128.0f)
+		return APPROX_INF;
+
+	i = (int)(x < 0.0f ? x - 0.5f : x + 0.5f);
+	f = x - (float)i;
+	p = (((((APPROX_E6 * f + APPROX_E5) * f + APPROX_E4) * f +
+		APPROX_E3) * f + APPROX_E2) * f + APPROX_E1) * f + APPROX_E0;
+
+	/* 2^128 is only reached as 2 * 2^127 */
+	if (i == 128)
+		return 2.0f * p * approx_as_float(254 << 23);
+	return p * approx_as_float((i + 127) << 23);
+}
+
+APPROX_FN float approx_log2(float x)
+{
+	int i = approx_as_int(x), e = ((i >> 23) & 0xff) - 127;
+	float m = approx_as_float((i & 0x7fffff) | 0x3f800000), t, u;
+
+	if (m > APPROX_SQRT2) {
+		m *= 0.5f;
+		e++;
+	}
+	t = (m - 1.0f) / (m + 1.0f);
+	u = t * t;
+
+	return (float)e + t * (((APPROX_L3 * u + APPROX_L2) * u +
+				 APPROX_L1) * u + APPROX_L0);
+}
+
+/* integer powers by squaring, negative ones through the reciprocal */
+APPROX_FN float approx_powi(float x, int e)
+{
+	float r = 1.0f;
+	int k = e < 0 ? -e : e;
+
+	for (; k; k >>= 1, x *= x)
+		if (k & 1)
+			r *= x;
+	return e < 0 ? 1.0f / r : r;
+}
+
+APPROX_FN float approx_pow(float x, float y)
+{
+	if (y >= -APPROX_POWI_MAX && y <= APPROX_POWI_MAX && y == (float)(int)y)
+		return approx_powi(x, (int)y);
+	if (x <= 0.0f)
+		return x == 0.0f ? (y > 0.0f ? 0.0f : APPROX_INF) : APPROX_NAN;
+
+	return approx_exp2(y * approx_log2(x));
+}
+
+/******************************************************************************/
+
+/* halving the exponent makes the first guess, two Newton steps refine it */
+APPROX_FN float approx_rsqrt(float x)
+{
+	float h = 0.5f * x;
+	float r = approx_as_float(0x5f375a86 - (approx_as_int(x) >> 1));
+
+	r *= 1.5f - h * r * r;
+	r *= 1.5f - h * r * r;
+	return r;
+}
+
+/* once x / m has no bits below the point, everything is a multiple of m */
+APPROX_FN float approx_fmod(float x, float m)
+{
+	float q = x / m;
+
+	if (q >= 8388608.0f || q <= -8388608.0f)
+		return 0.0f;
+	return x - m * (float)(int)q;
+}
+
+/******************************************************************************/
+
+/*
+ * The sin Taylor series out to a given number of terms past x, in Horner
+ * form in x^2 over (-1)^k / (2k + 1)!. Terms past x^33 / 33! are left off,
+ * the factorial overflows a float there.
+ */
+
+#define APPROX_TAYLOR	17
+
+APPROX_CONST float approx_sin_taylor[APPROX_TAYLOR] = {
+	 1.000000000e+00f, -1.666666667e-01f,  8.333333333e-03f,
+	-1.984126984e-04f,  2.755731922e-06f, -2.505210839e-08f,
+	 1.605904384e-10f, -7.647163732e-13f,  2.811457254e-15f,
+	-8.220635247e-18f,  1.957294106e-20f, -3.868170171e-23f,
+	 6.446950284e-26f, -9.183689864e-29f,  1.130996289e-31f,
+	-1.216125042e-34f,  1.151633562e-37f,
+};
+
+APPROX_FN float approx_taylor_sin(float x, int terms)
+{
+	float z = x * x, y;
+
+	if (terms > APPROX_TAYLOR - 1)
+		terms = APPROX_TAYLOR - 1;
+
+	for (y = approx_sin_taylor[terms]; terms--; )
+		y = y * z + approx_sin_taylor[terms];
+	return y * x;
+}
@@ -35,7 +35,8 @@ void dbcl_close(struct dbcl *d)
 	free(d);
 }
 
-struct dbcl *dbcl_open(const char **kernel_source)
+/* sources are compiled as one program, in order */
+struct dbcl *dbcl_open(const char **sources, int count)
 {
 	struct dbcl *d = malloc(sizeof(*d));
 	char buf[2048];
@@ -59,7 +60,7 @@ struct dbcl *dbcl_open(const char **kernel_source)
 	if (!d->commands)
 		goto exit_error;
 
-	d->program = clCreateProgramWithSource(d->context, 1, kernel_source,
+	d->program = clCreateProgramWithSource(d->context, count, sources,
 						NULL, &err);
 	if (!d->program)
 		goto exit_error;
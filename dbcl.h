@@ -3,7 +3,7 @@
 
 struct dbcl;
 
-struct dbcl *dbcl_open  (const char **kernel_source);
+struct dbcl *dbcl_open  (const char **sources, int count);
 void         dbcl_close (struct dbcl *dbcl);
 
 int dbcl_ouptut_buffer (struct dbcl *d, unsigned int size);
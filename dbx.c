@@ -1,11 +1,20 @@
 /* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
 
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 
 #include "dbx.h"
 
+#include <X11/extensions/XShm.h>
+
 #define DISP_DIV	3
 
 int display_divider(void)
@@ -31,11 +40,18 @@ u64 tickcount_us(void)
 	return (tp.tv_sec * 1000000 + tp.tv_nsec / 1000);
 }
 
+/* headless runs advance this by t_ms per frame instead of reading the clock */
+static int virtual_clock;
+static u32 virtual_ms;
+
 u32 tickcount_ms(void)
 {
 	struct timespec tp;
 	static u32 start;
 
+	if (virtual_clock)
+		return virtual_ms;
+
 	if (clock_gettime(CLOCK_MONOTONIC, &tp)) {
 		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
 		return 0;
@@ -59,7 +75,109 @@ void int_mod(int *v, int min, int max, int delta)
 
 /******************************************************************************/
 
-#define CLR_CNT	2500
+/* 1 << 12, open addressed by rgb */
+#define CLR_CNT	4096
+
+struct dbx_color {
+	u32 rgb;
+	u32 used;
+	unsigned long pixel;
+};
+
+struct dbx_chan {
+	unsigned long mask;
+	int shift;
+	int bits;
+};
+
+#define TEXT_LEN	128
+
+struct dbx_text {
+	int x, y;
+	int len;
+	char s[TEXT_LEN];
+};
+
+/* growable array, only ever reset, never shrunk */
+struct dbx_vec {
+	void *p;
+	int cnt;
+	int sz;
+};
+
+/* inclusive pixel bounds */
+struct dbx_box {
+	int x1, y1, x2, y2;
+};
+
+/* primitives of one color, flushed as one request per kind */
+struct dbx_batch {
+	u32 rgb;
+	struct dbx_box box;
+	struct dbx_vec fill;
+	struct dbx_vec rect;
+	struct dbx_vec arc;
+	struct dbx_vec seg;
+	struct dbx_vec pt;
+	struct dbx_vec text;
+};
+
+#define BATCH_CNT	64
+
+/* a few boxes, merged as they overlap, so sparse scenes stay sparse */
+#define DAMAGE_CNT	16
+
+struct dbx_damage {
+	struct dbx_box r[DAMAGE_CNT];
+	int cnt;
+};
+
+enum { CMD_FILL, CMD_RECT, CMD_CIRCLE, CMD_STRING, CMD_POINT, CMD_LINE,
+       CMD_IMAGE };
+
+struct dbx_image {
+	int x, y, wd, ht;
+	const u32 *px;
+	int stride;
+};
+
+/*
+ * a drawing call kept by a layer, v[0] of a string or an image indexes the
+ * layer's text or img
+ */
+struct dbx_cmd {
+	int op;
+	int v[4];
+	u32 rgb;
+	struct dbx_box box;
+};
+
+struct dbx_layer {
+	struct dbx_vec cmd;
+	struct dbx_vec text;
+	struct dbx_vec img;
+	struct dbx_damage ext;		/* covered by cmd */
+	struct dbx_damage shown;	/* covered when last composited */
+	int dirty;
+	int changed;
+};
+
+/* log-linear: exact below HIST_SUB, then HIST_SUB buckets per power of two */
+#define HIST_SUB	8
+#define HIST_CNT	(32 * HIST_SUB)
+
+struct dbx_hist {
+	u32 b[HIST_CNT];
+	u64 cnt;
+	u64 max;
+};
+
+enum { PH_UPDATE, PH_PRESENT, PH_EVENTS, PH_SLEEP, PH_CNT };
+
+/* what dbx_loop does when update overruns its period, see DBX_OVERRUN */
+enum { OVERRUN_DROP, OVERRUN_CATCHUP, OVERRUN_STRETCH };
+
+#define CATCHUP_MAX	4
 
 struct dbx {
 	XFontStruct *font;
@@ -71,11 +189,234 @@ struct dbx {
 	int width;
 	int height;
 	GC gc;
-	XColor colors[CLR_CNT];
-	u32 rgbs[CLR_CNT];
+	int truecolor;
+	struct dbx_chan chan[3];
+	struct dbx_color colors[CLR_CNT];
 	int clr_cnt;
+
+	/* frames left to render offscreen, see DBX_HEADLESS */
+	int headless;
+	const char *ppm;
+
+	/* framebuffer mode, see dbx_framebuffer() */
+	int fb_mode;
+	int shm_ok;
+	XImage *img;
+	XShmSegmentInfo shm;
+	u32 *fb;
+	int fb_stride;
+
+	/*
+	 * presented image, window sized; fb is the same buffer unless frames
+	 * are rendered smaller and scaled up, see DBX_DYNRES
+	 */
+	u32 *out;
+	int out_stride;
+	int win_width;
+	int win_height;
+	u32 dynres_us;
+	int bilinear;
+	float scale;
+	float frame_us;
+
+	struct dbx_batch batch[BATCH_CNT];
+	int batch_cnt;
+
+	/* changed since the last present / painted since the last blank */
+	struct dbx_damage damage;
+	struct dbx_damage drawn;
+
+	/* drawing is clipped to this, the window except while composing */
+	struct dbx_box clip;
+
+	/* see dbx_layer(), layer is -1 until an app selects one */
+	struct dbx_layer layers[DBX_LAYERS];
+	int layer;
+	int composing;
+	int bg_ok;
+	Pixmap bg;
+	u32 *bg_fb;
+
+	/* frame phase timing, see DBX_STATS */
+	int stats;
+	u32 t_ms;
+	u64 overruns;
+	struct dbx_hist hist[PH_CNT];
+
+	/* update said nothing changed, sleep until input arrives */
+	int idle;
+	int dirty;
+
+	/* input since the last update */
+	int events;
+	struct dbx_vec motion;
+	struct dbx_hist ev_hist;
+
+	int overrun;
+	u64 dropped;
+	u64 fps_ns;
+	int fps_frames;
+	float fps;
+};
+
+static void fb_present(struct dbx *d, struct dbx_damage *dm);
+static void batch_flush(struct dbx *d, Drawable dst);
+static void batch_reset(struct dbx *d);
+static void batch_free(struct dbx *d);
+static void damage_full(struct dbx *d, struct dbx_damage *dm);
+static void clip_full(struct dbx *d);
+static void layers_compose(struct dbx *d, int full);
+static void layers_free(struct dbx *d);
+static void dynres_config(struct dbx *d);
+static void dynres_update(struct dbx *d, u64 us);
+static void *vec_add(struct dbx_vec *v, size_t esz);
+
+/* full repaints the whole window (Expose) rather than just the damage */
+static int dbx_present(struct dbx *d, int full)
+{
+	struct dbx_damage all = { { { 0, 0, d->width - 1, d->height - 1 } }, 1 };
+	struct dbx_damage *dm = full ? &all : &d->damage;
+	struct dbx_box *r;
+	int i;
+
+	if (d->layer >= 0)
+		layers_compose(d, full);
+
+	if (d->fb_mode) {
+		fb_present(d, dm);
+		d->damage.cnt = 0;
+		return 0;
+	}
+
+	batch_flush(d, d->pixmap);
+	batch_reset(d);
+
+	for (i = 0; i < dm->cnt; i++) {
+		r = &dm->r[i];
+		if (!XCopyArea(d->display, d->pixmap, d->win, d->gc, r->x1, r->y1,
+				r->x2 - r->x1 + 1, r->y2 - r->y1 + 1, r->x1, r->y1)) {
+			printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+			return -1;
+		}
+	}
+	d->damage.cnt = 0;
+	return 0;
+}
+
+/******************************************************************************/
+
+/*
+ * DBX_STATS=1 keeps a microsecond histogram per dbx_loop phase, printed at
+ * exit or when F12 is pressed. An overrun is a frame whose update and
+ * present together took longer than the update period.
+ */
+
+static const char *phase_names[PH_CNT] = {
+	[PH_UPDATE]  = "update",
+	[PH_PRESENT] = "present",
+	[PH_EVENTS]  = "events",
+	[PH_SLEEP]   = "sleep",
 };
 
+static int hist_idx(u64 v)
+{
+	int e;
+
+	if (v < HIST_SUB)
+		return v;
+	v = MIN(v, 0xffffffffull);
+	e = 63 - __builtin_clzll(v);
+	return (e - 2) * HIST_SUB + ((v >> (e - 3)) & (HIST_SUB - 1));
+}
+
+/* largest value that lands in bucket i */
+static u64 hist_val(int i)
+{
+	int e = i / HIST_SUB + 2;
+
+	if (i < HIST_SUB)
+		return i;
+	return ((u64)(HIST_SUB + i % HIST_SUB + 1) << (e - 3)) - 1;
+}
+
+static void hist_add(struct dbx_hist *h, u64 v)
+{
+	h->b[hist_idx(v)]++;
+	h->cnt++;
+	h->max = MAX(h->max, v);
+}
+
+static u64 hist_pct(struct dbx_hist *h, int pct)
+{
+	u64 n = 0, want = (h->cnt * pct + 99) / 100;
+	int i;
+
+	for (i = 0; i < HIST_CNT; i++) {
+		n += h->b[i];
+		if (n && n >= want)
+			return MIN(hist_val(i), h->max);
+	}
+	return h->max;
+}
+
+static void stats_phase(struct dbx *d, int phase, u64 *us)
+{
+	u64 now;
+
+	if (!d->stats)
+		return;
+
+	now = tickcount_us();
+	hist_add(&d->hist[phase], now - *us);
+	*us = now;
+}
+
+/* start is when the frame's update began, us is after its present */
+static void stats_frame(struct dbx *d, u64 start, u64 us)
+{
+	if (d->stats && us - start > d->t_ms * 1000ull)
+		d->overruns++;
+}
+
+/* the input update just consumed, counted per frame */
+static void stats_input(struct dbx *d)
+{
+	if (d->stats)
+		hist_add(&d->ev_hist, d->events);
+
+	d->events = 0;
+	d->motion.cnt = 0;
+	d->dirty = 0;
+}
+
+static void stats_print(struct dbx *d)
+{
+	struct dbx_hist *h;
+	int i;
+
+	if (!d->stats)
+		return;
+
+	printf("%-8s %8s %8s %8s %8s (us)\n", "phase", "count", "p50", "p99", "max");
+	for (i = 0; i < PH_CNT; i++) {
+		h = &d->hist[i];
+		printf("%-8s %8llu %8llu %8llu %8llu\n", phase_names[i],
+			(unsigned long long)h->cnt,
+			(unsigned long long)hist_pct(h, 50),
+			(unsigned long long)hist_pct(h, 99),
+			(unsigned long long)h->max);
+	}
+	h = &d->ev_hist;
+	printf("%-8s %8llu %8llu %8llu %8llu (events per frame)\n", "input",
+		(unsigned long long)h->cnt,
+		(unsigned long long)hist_pct(h, 50),
+		(unsigned long long)hist_pct(h, 99),
+		(unsigned long long)h->max);
+	printf("overruns %llu (> %u ms), %llu periods dropped, %.1f fps\n",
+		(unsigned long long)d->overruns, d->t_ms,
+		(unsigned long long)d->dropped, d->fps);
+}
+
 static int keycode(Display *display, int k, int shift)
 {
 	static int syms_per_code;
@@ -90,95 +431,274 @@ static int keycode(Display *display, int k, int shift)
 	return ks[(k - min) * syms_per_code + shift];
 }
 
-static int handle_events(struct dbx *d, struct dbx_ops *ops)
+static int dispatch_event(struct dbx *d, struct dbx_ops *ops, XEvent *e)
 {
-	XEvent e;
 	int k;
 
-	for ( ;XPending(d->display); ) {
-		XNextEvent(d->display, &e);
-
-		switch (e.type) {
-		case Expose:
-			if (e.xexpose.count)
-				break;
+	switch (e->type) {
+	case Expose:
+		if (e->xexpose.count)
+			break;
 
-			if (!XCopyArea(d->display, d->pixmap, d->win, d->gc, 0, 0,
-					d->width, d->height, 0, 0)) {
-				printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		if (dbx_present(d, 1))
+			return -1;
+		break;
+	case MotionNotify:
+		d->dirty = 1;
+		if (ops->motion)
+			if (ops->motion(d, &e->xmotion))
 				return -1;
+		break;
+	case ConfigureNotify:
+		d->dirty = 1;
+		if (ops->configure)
+			if (ops->configure(d, &e->xconfigure))
+				return -1;
+		break;
+	case KeyPress:
+	case KeyRelease:
+		d->dirty = 1;
+		k = keycode(d->display, e->xkey.keycode, e->xkey.state & 1);
+		if (k == XK_F12 && e->type == KeyPress)
+			stats_print(d);
+		if (ops->key) {
+			if (ops->key(d, e->xkey.keycode, k,
+				     e->type == KeyPress))
+				return -1;
+		}
+		break;
+	case ButtonPress://XEvent
+		d->dirty = 1;
+		if (ops->button)
+			if (ops->button(d, e->xbutton.button, e->xbutton.x, e->xbutton.y,
+					e->xbutton.type == ButtonPress))
+				return -1;
+		break;
+	}
+	return 0;
+}
+
+/*
+ * Only the events already read from the connection are handled, so a burst
+ * can't keep the loop from rendering. A run of MotionNotify is delivered to
+ * ops->motion as its last event; apps that set DBX_MOTION_HISTORY get every
+ * sample from dbx_motion_history().
+ */
+static int handle_events(struct dbx *d, struct dbx_ops *ops)
+{
+	int i, n = XEventsQueued(d->display, QueuedAfterReading);
+	XEvent e, motion;
+	XTimeCoord *tc;
+	int pending = 0;
+
+	for (i = 0; i < n; i++) {
+		XNextEvent(d->display, &e);
+		d->events++;
+
+		if (e.type == MotionNotify) {
+			if ((ops->flags & DBX_MOTION_HISTORY) &&
+			    (tc = vec_add(&d->motion, sizeof(*tc)))) {
+				tc->time = e.xmotion.time;
+				tc->x = e.xmotion.x;
+				tc->y = e.xmotion.y;
 			}
-			break;
-		case MotionNotify:
-			if (ops->motion)
-				if (ops->motion(d, &e.xmotion))
-					return -1;
-			break;
-		case ConfigureNotify:
-			if (ops->configure)
-				if (ops->configure(d, &e.xconfigure))
-					return -1;
-			break;
-		case KeyPress:
-		case KeyRelease:
-			if (ops->key) {
-				k = keycode(d->display, e.xkey.keycode,
-						e.xkey.state & 1);
-				if (ops->key(d, e.xkey.keycode, k,
-					     e.type == KeyPress))
-					return -1;
-			}
-			break;
-		case ButtonPress://XEvent
-			if (ops->button)
-				if (ops->button(d, e.xbutton.button, e.xbutton.x, e.xbutton.y,
-						e.xbutton.type == ButtonPress))
-					return -1;
-			break;
+			motion = e;
+			pending = 1;
+			continue;
 		}
+
+		/* keep motion ordered against the other events */
+		if (pending && dispatch_event(d, ops, &motion))
+			return -1;
+		pending = 0;
+
+		if (dispatch_event(d, ops, &e))
+			return -1;
 	}
+
+	if (pending && dispatch_event(d, ops, &motion))
+		return -1;
 	return 0;
 }
 
+static u64 monotonic_ns(void)
+{
+	struct timespec tp;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &tp)) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		return 0;
+	}
+	return tp.tv_sec * 1000000000ull + tp.tv_nsec;
+}
+
+/* presented frames per second, measured over the last second or so */
+static void fps_update(struct dbx *d, u64 now)
+{
+	if (!d->fps_ns)
+		d->fps_ns = now;
+
+	d->fps_frames++;
+	if (now - d->fps_ns < 1000000000ull)
+		return;
+
+	d->fps = d->fps_frames * 1e9f / (now - d->fps_ns);
+	d->fps_frames = 0;
+	d->fps_ns = now;
+}
+
+static void headless_loop(struct dbx *d, struct dbx_ops *ops, u32 t_ms)
+{
+	int frames = d->headless;
+	u64 start, us, f, t;
+
+	if (ops->init)
+		ops->init(d);
+
+	start = us = tickcount_us();
+	for (; d->headless; d->headless--) {
+		f = us;
+		t = tickcount_us();
+		ops->update(d);
+		stats_phase(d, PH_UPDATE, &us);
+		if (dbx_present(d, 0))
+			return;
+		stats_phase(d, PH_PRESENT, &us);
+		stats_frame(d, f, us);
+		dynres_update(d, tickcount_us() - t);
+		fps_update(d, monotonic_ns());
+		virtual_ms += t_ms;
+	}
+	us = tickcount_us() - start;
+
+	printf("headless %dx%d: %d frames in %llu us, %.1f fps\n",
+		d->win_width, d->win_height, frames, (unsigned long long)us,
+		frames * 1000000.0 / MAX(us, 1));
+	if (d->dynres_us)
+		printf("render scale %.2f (%dx%d)\n", d->scale, d->width, d->height);
+}
+
+/*
+ * Frames are due at absolute CLOCK_MONOTONIC deadlines, so handling events
+ * while waiting never pushes the next update back. When a deadline is missed
+ * by more than a period, DBX_OVERRUN picks between skipping the missed
+ * periods (drop, the default), running up to CATCHUP_MAX updates for them
+ * before presenting (catchup), or starting the next frame right away and
+ * keeping time from there (stretch).
+ *
+ * An update returning DBX_IDLE hasn't touched the pixmap, so nothing is
+ * presented and the loop blocks until input marks the scene dirty, at which
+ * point the next frame is due immediately. See dbx_dirty().
+ */
 static void dbx_loop(struct dbx *d, struct dbx_ops *ops, u32 t_ms)
 {
-	int fd = ConnectionNumber(d->display);
-	struct timeval tv = { .tv_sec = 0 };
-	fd_set in_fds;
-	u32 tc, t;
-	int ret;
+	struct pollfd pfd = { .fd = ConnectionNumber(d->display), .events = POLLIN };
+	u64 period = t_ms * 1000000ull;
+	u64 deadline, now, n;
+	struct timespec ts;
+	u64 us, f, t;
+	int ret, i, queued;
 
 	if (ops->init)
 		ops->init(d);
 
+	d->dirty = 1;
 	ops->update(d);
+	stats_input(d);
 
-	tc = tickcount_ms();
+	deadline = monotonic_ns() + period;
+	us = tickcount_us();
 	for ( ;; ) {
-		FD_ZERO(&in_fds);
-		FD_SET(fd, &in_fds);
-
-		t = tickcount_ms();
-		tv.tv_usec = 1000 * (t_ms - MIN(t_ms, (t - tc)));
-
-		ret = select(fd + 1, &in_fds, NULL, NULL, &tv);
-		if (ret < 0)
-			printf("An error occured!\n");
-		else if (ret == 0) {
-			ops->update(d);
-			if (!XCopyArea(d->display, d->pixmap, d->win, d->gc, 0, 0,
-					d->width, d->height, 0, 0)) {
-				printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
-				return;
+		if (handle_events(d, ops))
+			return;
+		stats_phase(d, PH_EVENTS, &us);
+
+		if (d->dirty && d->idle) {
+			d->idle = 0;
+			deadline = monotonic_ns();
+		}
+
+		/* events read past the last drain won't wake ppoll */
+		XFlush(d->display);
+		queued = XEventsQueued(d->display, QueuedAlready);
+		if (d->idle) {
+			if (!queued && ppoll(&pfd, 1, NULL, NULL) < 0 && errno != EINTR)
+				printf("An error occured!\n");
+			stats_phase(d, PH_SLEEP, &us);
+			continue;
+		}
+
+		now = monotonic_ns();
+		if (now < deadline) {
+			if (queued)
+				continue;
+			ts.tv_sec = (deadline - now) / 1000000000ull;
+			ts.tv_nsec = (deadline - now) % 1000000000ull;
+			ret = ppoll(&pfd, 1, &ts, NULL);
+			stats_phase(d, PH_SLEEP, &us);
+			if (ret < 0 && errno != EINTR)
+				printf("An error occured!\n");
+			continue;
+		}
+
+		/* periods owed, only catchup pays for more than this one */
+		n = 1;
+		if (d->overrun == OVERRUN_CATCHUP) {
+			n = 1 + (now - deadline) / period;
+			if (n > CATCHUP_MAX) {
+				d->dropped += n - CATCHUP_MAX;
+				deadline += (n - CATCHUP_MAX) * period;
+				n = CATCHUP_MAX;
 			}
-			tc = tickcount_ms();
 		}
 
-		if (handle_events(d, ops))
+		f = us;
+		t = tickcount_us();
+		for (i = 0; i < n; i++)
+			d->idle = ops->update(d) == DBX_IDLE;
+		stats_input(d);
+		stats_phase(d, PH_UPDATE, &us);
+		if (d->idle)
+			continue;
+		if (dbx_present(d, 0))
 			return;
+		stats_phase(d, PH_PRESENT, &us);
+		stats_frame(d, f, us);
+		dynres_update(d, (tickcount_us() - t) / n);
+
+		now = monotonic_ns();
+		fps_update(d, now);
+		deadline += n * period;
+		if (now < deadline)
+			continue;
+
+		switch (d->overrun) {
+		case OVERRUN_DROP:
+			n = 1 + (now - deadline) / period;
+			d->dropped += n;
+			deadline += n * period;
+			break;
+		case OVERRUN_STRETCH:
+			deadline = now;
+			break;
+		}
 	}
 }
 
+static int overrun_policy(void)
+{
+	const char *s = getenv("DBX_OVERRUN");
+
+	if (!s || !strcmp(s, "drop"))
+		return OVERRUN_DROP;
+	if (!strcmp(s, "catchup"))
+		return OVERRUN_CATCHUP;
+	if (!strcmp(s, "stretch"))
+		return OVERRUN_STRETCH;
+	printf("DBX_OVERRUN should be drop, catchup or stretch\n");
+	return OVERRUN_DROP;
+}
+
 static int set_window_properties(Display *display, Window win, int argc, char *argv[])
 {
 	char *window_name = "DBB X Test";
@@ -228,20 +748,72 @@ static int set_window_properties(Display *display, Window win, int argc, char *a
 	return 0;
 }
 
+static void chan_init(struct dbx_chan *c, unsigned long mask)
+{
+	c->mask = mask;
+	for (c->shift = 0; mask && !(mask & 1); mask >>= 1)
+		c->shift++;
+	for (c->bits = 0; mask & 1; mask >>= 1)
+		c->bits++;
+}
+
 static Colormap init_colormap(struct dbx *d, Window rwin)
 {
 	XVisualInfo vi;
 
 	d->clr_cnt = 0;
+	memset(d->colors, 0, sizeof(d->colors));
 
-	if (!XMatchVisualInfo(d->display, d->screen, 24, TrueColor, &vi)) {
-		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
-		return -1;
+	d->truecolor = XMatchVisualInfo(d->display, d->screen, 24, TrueColor, &vi);
+	if (!d->truecolor) {
+		printf("no 24 bit TrueColor visual, allocating colors\n");
+		return DefaultColormap(d->display, d->screen);
 	}
 
+	chan_init(&d->chan[0], vi.red_mask);
+	chan_init(&d->chan[1], vi.green_mask);
+	chan_init(&d->chan[2], vi.blue_mask);
+
 	return XCreateColormap(d->display, rwin, vi.visual, AllocNone);
 }
 
+static int fb_render_init(struct dbx *d);
+
+#define HEADLESS_WIDTH	1920
+#define HEADLESS_HEIGHT	1080
+
+/*
+ * DBX_HEADLESS=<frames> renders that many frames into client memory without
+ * an X server, with tickcount_ms() following a virtual clock so animations
+ * run at full speed, and DBX_PPM=<prefix> dumps every frame as a PPM file.
+ * Strings are not rasterized.
+ */
+static int headless_init(struct dbx *d, const char *frames)
+{
+	int disp_div = display_divider();
+
+	d->headless = atoi(frames);
+	if (d->headless <= 0) {
+		fprintf(stderr, "DBX_HEADLESS should be a frame count\n");
+		return -1;
+	}
+	d->ppm = getenv("DBX_PPM");
+
+	d->width  = d->win_width  = HEADLESS_WIDTH / disp_div;
+	d->height = d->win_height = HEADLESS_HEIGHT / disp_div;
+
+	d->out = calloc(d->width * d->height, sizeof(u32));
+	if (!d->out)
+		return -1;
+	d->out_stride = d->width;
+	if (fb_render_init(d))
+		return -1;
+	d->fb_mode = 1;
+
+	virtual_clock = 1;
+	return 0;
+}
+
 static int dbx_init(struct dbx *d, int argc, char *argv[])
 {
 	char *display_name = NULL;
@@ -251,8 +823,13 @@ static int dbx_init(struct dbx *d, int argc, char *argv[])
 	XGCValues values;
 	Window rwin;
 	int depth;
-	int disp_div = display_divider();
+	const char *frames = getenv("DBX_HEADLESS");
+	int disp_div;
 
+	if (frames)
+		return headless_init(d, frames);
+
+	disp_div = display_divider();
 	d->display = XOpenDisplay(display_name);
 	if (!d->display) {
 		fprintf(stderr, "%s: couldn't connect to X server %s\n",
@@ -268,8 +845,8 @@ static int dbx_init(struct dbx *d, int argc, char *argv[])
 	display_height = DisplayHeight(d->display, d->screen);
 	depth = DefaultDepth(d->display, d->screen);
 
-	d->width  = display_width / disp_div;
-	d->height = display_height / disp_div;
+	d->width  = d->win_width  = display_width / disp_div;
+	d->height = d->win_height = display_height / disp_div;
 
 	d->win = XCreateSimpleWindow(d->display, rwin, 90, 60, d->width, d->height,
 					border_width,
@@ -300,8 +877,21 @@ static int dbx_init(struct dbx *d, int argc, char *argv[])
 	return 0;
 }
 
+static void fb_deinit(struct dbx *d);
+
 static void dbx_deinit(struct dbx *d)
 {
+	layers_free(d);
+	if (!d->display) {
+		if (d->fb != d->out)
+			free(d->fb);
+		free(d->out);
+		return;
+	}
+
+	fb_deinit(d);
+	batch_free(d);
+	free(d->motion.p);
 	XFreePixmap(d->display, d->pixmap);
 	XUnloadFont(d->display, d->font->fid);
 	XFreeGC(d->display, d->gc);
@@ -310,10 +900,24 @@ static void dbx_deinit(struct dbx *d)
 
 void dbx_run(int argc, char *argv[], struct dbx_ops *ops, u32 t_ms)
 {
-	struct dbx d;
-
-	dbx_init(&d, argc, argv);
-	dbx_loop(&d, ops, t_ms);
+	struct dbx d = { .fb_mode = 0, .layer = -1 };
+
+	d.stats = getenv("DBX_STATS") != NULL;
+	d.overrun = overrun_policy();
+	d.t_ms = t_ms;
+	dynres_config(&d);
+
+	if (dbx_init(&d, argc, argv))
+		return;
+	clip_full(&d);
+	/* the pixmap starts out undefined */
+	damage_full(&d, &d.drawn);
+	damage_full(&d, &d.damage);
+	if (d.headless)
+		headless_loop(&d, ops, t_ms);
+	else
+		dbx_loop(&d, ops, t_ms);
+	stats_print(&d);
 	dbx_deinit(&d);
 }
 
@@ -328,35 +932,64 @@ static void color_init(XColor *c, u32 v)
 	c->flags = DoRed | DoGreen | DoBlue;
 }
 
+static unsigned long chan_pixel(struct dbx_chan *c, u32 v)
+{
+	v &= 0xff;
+	if (c->bits < 8)
+		v >>= 8 - c->bits;
+	else
+		v <<= c->bits - 8;
+	return ((unsigned long)v << c->shift) & c->mask;
+}
+
+static unsigned long alloc_pixel(struct dbx *d, u32 rgb)
+{
+	XColor c;
+
+	color_init(&c, rgb);
+	if (!XAllocColor(d->display, d->cm, &c)) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		return WhitePixel(d->display, d->screen);
+	}
+	return c.pixel;
+}
+
 static unsigned long rgb2pixel(struct dbx *d, u32 rgb)
 {
-	XColor *c;
-	int i;
+	struct dbx_color *c;
+	u32 i;
+
+	if (d->truecolor)
+		return chan_pixel(&d->chan[0], rgb >> 16) |
+		       chan_pixel(&d->chan[1], rgb >>  8) |
+		       chan_pixel(&d->chan[2], rgb >>  0);
 
 	if (!rgb)
 		return BlackPixel(d->display, d->screen);
 	if (rgb == RGB(255, 255, 255))
 		return WhitePixel(d->display, d->screen);
 
-	for (i = 0; i < d->clr_cnt; i++)
-		if (d->rgbs[i] == rgb)
-			return d->colors[i].pixel;
+	/* fibonacci hash, top 12 bits index the table */
+	for (i = (rgb * 2654435761u) >> 20; ; i++) {
+		c = &d->colors[i & (CLR_CNT - 1)];
+		if (!c->used)
+			break;
+		if (c->rgb == rgb)
+			return c->pixel;
+	}
 
-	if (ARRAY_SIZE(d->colors) == d->clr_cnt + 1) {
-		printf("! color array size (%u)\n", tickcount_ms());
+	/* keep the table at most 3/4 full so misses stay short */
+	if (d->clr_cnt >= CLR_CNT * 3 / 4) {
+		if (d->clr_cnt == CLR_CNT * 3 / 4)
+			printf("! color array size (%u)\n", tickcount_ms());
+		d->clr_cnt = CLR_CNT;
 		return WhitePixel(d->display, d->screen);
 	}
 
-	c = &d->colors[d->clr_cnt];
-	d->rgbs[d->clr_cnt++] = rgb;
-
-	color_init(c, rgb);
-	if (!XAllocColor(d->display, d->cm, c))
-		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
-	else
-		printf("RGB %04x %04x %04x | %06lx\n", c->red, c->green, c->blue,
-			c->pixel);
-
+	c->used = 1;
+	c->rgb = rgb;
+	c->pixel = alloc_pixel(d, rgb);
+	d->clr_cnt++;
 	return c->pixel;
 }
 
@@ -375,65 +1008,1238 @@ int dbx_set_foreground(struct dbx *d, u32 rgb)
 	return 0;
 }
 
-int dbx_draw_rectangle(struct dbx *d, int x, int y, int wd, int ht, u32 rgb)
+/******************************************************************************/
+
+/*
+ * Every primitive's bounding box is added to the damage, which present copies
+ * to the window, and to the drawn area, which dbx_blank_pixmap() clears
+ * instead of the whole pixmap.
+ */
+
+static long box_area(struct dbx_box *b)
 {
-	dbx_set_foreground(d, rgb);
-	if (!XDrawRectangle(d->display, d->pixmap, d->gc, x, y, wd, ht))
-		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
-	return 0;
+	return (long)(b->x2 - b->x1 + 1) * (b->y2 - b->y1 + 1);
 }
 
-int dbx_fill_rectangle(struct dbx *d, int x, int y, int wd, int ht, u32 rgb)
+static int box_contains(struct dbx_box *a, struct dbx_box *b)
 {
-	dbx_set_foreground(d, rgb);
-	if (!XFillRectangle(d->display, d->pixmap, d->gc, x, y, wd, ht))
-		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
-	return 0;
+	return a->x1 <= b->x1 && a->y1 <= b->y1 && a->x2 >= b->x2 && a->y2 >= b->y2;
 }
 
-int dbx_blank_pixmap(struct dbx *d)
+static void box_union(struct dbx_box *a, struct dbx_box *b)
 {
-	dbx_fill_rectangle(d, 0, 0, d->width, d->height, RGB(0, 0, 0));
-	return 0;
+	a->x1 = MIN(a->x1, b->x1);
+	a->y1 = MIN(a->y1, b->y1);
+	a->x2 = MAX(a->x2, b->x2);
+	a->y2 = MAX(a->y2, b->y2);
 }
 
-int dbx_draw_string(struct dbx *d, int x, int y, const char *s, size_t len,
-		    u32 rgb)
+static void damage_full(struct dbx *d, struct dbx_damage *dm)
 {
-	dbx_set_foreground(d, rgb);
-	if (XDrawString(d->display, d->pixmap, d->gc, x, y, s, len))
-		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
-	return 0;
+	struct dbx_box *r = &dm->r[0];
+
+	r->x1 = r->y1 = 0;
+	r->x2 = d->width - 1;
+	r->y2 = d->height - 1;
+	dm->cnt = 1;
 }
 
-int dbx_fill_circle(struct dbx *d, int x, int y, int dia, u32 rgb)
+static void clip_full(struct dbx *d)
 {
-	dbx_set_foreground(d, rgb);
-	if (!XFillArc(d->display, d->pixmap, d->gc, x, y, dia, dia, 0, 360 * 64))
-		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
-	return 0;
+	d->clip.x1 = d->clip.y1 = 0;
+	d->clip.x2 = d->width - 1;
+	d->clip.y2 = d->height - 1;
 }
 
-int dbx_draw_point(struct dbx *d, int x, int y, u32 rgb)
+static void damage_add(struct dbx_damage *dm, struct dbx_box *b)
 {
-	dbx_set_foreground(d, rgb);
-	XDrawPoint(d->display, d->pixmap, d->gc, x, y);
-	return 0;
+	long waste, best_waste = 0;
+	struct dbx_box u, *r;
+	int i, best = -1;
+
+	for (i = 0; i < dm->cnt; i++) {
+		r = &dm->r[i];
+		if (box_contains(r, b))
+			return;
+
+		/* area the union would cover that neither box does */
+		u = *r;
+		box_union(&u, b);
+		waste = box_area(&u) - box_area(r) - box_area(b);
+		if (best < 0 || waste < best_waste) {
+			best = i;
+			best_waste = waste;
+		}
+	}
+
+	if (best < 0 || (best_waste > 0 && dm->cnt < DAMAGE_CNT)) {
+		dm->r[dm->cnt++] = *b;
+		return;
+	}
+
+	box_union(&dm->r[best], b);
+	u = dm->r[best];
+	for (i = 0; i < dm->cnt; )
+		if (i != best && box_contains(&u, &dm->r[i])) {
+			dm->r[i] = dm->r[--dm->cnt];
+			if (best == dm->cnt)
+				best = i;
+		} else {
+			i++;
+		}
 }
 
-int dbx_draw_line(struct dbx *d, int x1, int y1, int x2, int y2, u32 rgb)
+/* clip box to the clip area, 0 if nothing of it is left */
+static int box_clip(struct dbx *d, struct dbx_box *box)
+{
+	struct dbx_box *c = &d->clip;
+
+	if (box->x2 < c->x1 || box->y2 < c->y1 ||
+	    box->x1 > c->x2 || box->y1 > c->y2)
+		return 0;
+
+	box->x1 = MAX(box->x1, c->x1);
+	box->y1 = MAX(box->y1, c->y1);
+	box->x2 = MIN(box->x2, c->x2);
+	box->y2 = MIN(box->y2, c->y2);
+	return 1;
+}
+
+/* clip box and record it, 0 if nothing of it is visible */
+static int dbx_box_add(struct dbx *d, struct dbx_box *box)
+{
+	if (!box_clip(d, box))
+		return 0;
+
+	damage_add(&d->damage, box);
+	damage_add(&d->drawn, box);
+	return 1;
+}
+
+/******************************************************************************/
+
+/*
+ * Framebuffer mode: the frame lives in client memory (an XImage, placed in a
+ * MIT-SHM segment when the server supports it) and is uploaded to the window
+ * with a single put per frame instead of one X request per primitive. The
+ * drawing calls rasterize into it in software; strings still go through the
+ * core font and are drawn over the image after the upload.
+ */
+
+static int shm_error;
+static int shm_error_handler(Display *display, XErrorEvent *e)
 {
-	dbx_set_foreground(d, rgb);
-	XDrawLine(d->display, d->pixmap, d->gc, x1, y1, x2, y2);
+	shm_error = 1;
 	return 0;
 }
 
-int dbx_width(struct dbx *d)
+static int fb_shm_init(struct dbx *d, Visual *vis, int depth)
 {
-	return d->width;
+	int (*handler)(Display *, XErrorEvent *);
+
+	if (!XShmQueryExtension(d->display))
+		return -1;
+
+	d->img = XShmCreateImage(d->display, vis, depth, ZPixmap, NULL, &d->shm,
+				 d->win_width, d->win_height);
+	if (!d->img)
+		return -1;
+
+	d->shm.shmid = shmget(IPC_PRIVATE, d->img->bytes_per_line * d->img->height,
+			      IPC_CREAT | 0600);
+	if (d->shm.shmid < 0)
+		goto exit_image;
+
+	d->shm.shmaddr = d->img->data = shmat(d->shm.shmid, NULL, 0);
+	d->shm.readOnly = False;
+	if (d->shm.shmaddr == (char *)-1)
+		goto exit_shmid;
+
+	/* attach fails with BadAccess on a remote display */
+	shm_error = 0;
+	handler = XSetErrorHandler(shm_error_handler);
+	XShmAttach(d->display, &d->shm);
+	XSync(d->display, False);
+	XSetErrorHandler(handler);
+	if (shm_error)
+		goto exit_shmat;
+
+	shmctl(d->shm.shmid, IPC_RMID, NULL);
+	return 0;
+
+exit_shmat:
+	shmdt(d->shm.shmaddr);
+exit_shmid:
+	shmctl(d->shm.shmid, IPC_RMID, NULL);
+exit_image:
+	XDestroyImage(d->img);
+	d->img = NULL;
+	return -1;
 }
 
-int dbx_height(struct dbx *d)
+static int fb_init(struct dbx *d)
 {
-	return d->height;
+	Visual *vis = DefaultVisual(d->display, d->screen);
+	int depth = DefaultDepth(d->display, d->screen);
+	char *data;
+
+	d->shm_ok = !fb_shm_init(d, vis, depth);
+	if (!d->shm_ok) {
+		printf("MIT-SHM unavailable, using XPutImage\n");
+		data = malloc(d->win_width * d->win_height * sizeof(u32));
+		if (!data)
+			return -1;
+		d->img = XCreateImage(d->display, vis, depth, ZPixmap, 0, data,
+				      d->win_width, d->win_height, 32, 0);
+		if (!d->img) {
+			free(data);
+			return -1;
+		}
+	}
+
+	/* pixels are stored as RGB() values, so the visual has to agree */
+	if (d->img->bits_per_pixel != 32 || d->img->red_mask != 0xff0000 ||
+	    d->img->green_mask != 0x00ff00 || d->img->blue_mask != 0x0000ff) {
+		printf("%s:%d %s() unsupported visual\n", __FILE__, __LINE__, __func__);
+		return -1;
+	}
+
+	d->out = (u32 *)d->img->data;
+	d->out_stride = d->img->bytes_per_line / sizeof(u32);
+	return fb_render_init(d);
+}
+
+static void fb_deinit(struct dbx *d)
+{
+	if (!d->img)
+		return;
+
+	if (d->fb != d->out)
+		free(d->fb);
+	if (d->shm_ok) {
+		XShmDetach(d->display, &d->shm);
+		XDestroyImage(d->img);
+		shmdt(d->shm.shmaddr);
+	} else {
+		XDestroyImage(d->img);
+	}
+	d->img = NULL;
+	d->fb = d->out = NULL;
+	d->fb_mode = 0;
+}
+
+static void fb_dump(struct dbx *d)
+{
+	static int frame;
+	char name[256];
+	u8 *row;
+	u32 *p;
+	FILE *f;
+	int x, y;
+
+	snprintf(name, sizeof(name), "%s%05d.ppm", d->ppm, frame++);
+	f = fopen(name, "wb");
+	row = malloc(d->win_width * 3);
+	if (!f || !row) {
+		printf("%s:%d %s() %s\n", __FILE__, __LINE__, __func__, name);
+		goto exit;
+	}
+
+	fprintf(f, "P6\n%d %d\n255\n", d->win_width, d->win_height);
+	for (y = 0; y < d->win_height; y++) {
+		p = &d->out[y * d->out_stride];
+		for (x = 0; x < d->win_width; x++) {
+			row[x * 3 + 0] = p[x] >> 16;
+			row[x * 3 + 1] = p[x] >> 8;
+			row[x * 3 + 2] = p[x];
+		}
+		fwrite(row, 3, d->win_width, f);
+	}
+exit:
+	free(row);
+	if (f)
+		fclose(f);
+}
+
+/*
+ * DBX_DYNRES=<ms> renders framebuffer frames into a buffer of their own at a
+ * fraction of the window size, picked after every frame so update + present
+ * stays near <ms>, and scales it up into the presented image. dbx_width() and
+ * dbx_height() are the render size and only change between frames.
+ * DBX_UPSCALE=bilinear filters the upscale, nearest is the default.
+ */
+
+#define SCALE_MIN	0.25f
+#define SCALE_STEP	0.05f	/* smaller corrections aren't worth a resize */
+
+static void dynres_config(struct dbx *d)
+{
+	const char *s = getenv("DBX_DYNRES");
+	const char *f = getenv("DBX_UPSCALE");
+
+	d->scale = 1.0f;
+	if (s)
+		d->dynres_us = atoi(s) * 1000;
+	d->bilinear = f && !strcmp(f, "bilinear");
+}
+
+/* point fb at the render buffer, the image itself unless DBX_DYNRES is set */
+static int fb_render_init(struct dbx *d)
+{
+	if (!d->dynres_us) {
+		d->fb = d->out;
+		d->fb_stride = d->out_stride;
+		return 0;
+	}
+
+	/* sized for scale 1, smaller frames use the top left of it */
+	d->fb = calloc(d->win_width * d->win_height, sizeof(u32));
+	if (!d->fb)
+		return -1;
+	d->fb_stride = d->win_width;
+	return 0;
+}
+
+static void dynres_update(struct dbx *d, u64 us)
+{
+	float s;
+	int i;
+
+	if (!d->fb_mode || d->fb == d->out)
+		return;
+
+	d->frame_us = d->frame_us ? d->frame_us * 0.8f + us * 0.2f : us;
+
+	/* cost goes with the pixel count, the square of the scale */
+	s = d->scale * sqrtf(d->dynres_us / MAX(d->frame_us, 1.0f));
+	s = MIN(MAX(s, SCALE_MIN), 1.0f);
+	if (fabsf(s - d->scale) < SCALE_STEP && s != 1.0f && s != SCALE_MIN)
+		return;
+	if (s == d->scale)
+		return;
+
+	d->frame_us *= s * s / (d->scale * d->scale);
+	d->scale = s;
+	d->width = MAX(1, (int)(d->win_width * s + 0.5f));
+	d->height = MAX(1, (int)(d->win_height * s + 0.5f));
+	clip_full(d);
+
+	/* whatever was drawn is at the old size */
+	damage_full(d, &d->damage);
+	damage_full(d, &d->drawn);
+	for (i = 0; i < DBX_LAYERS; i++)
+		d->layers[i].dirty = 1;
+	d->bg_ok = 0;
+}
+
+static inline u32 lerp_rgb(u32 a, u32 b, u32 f)
+{
+	u32 rb = ((a & 0xff00ff) * (256 - f) + (b & 0xff00ff) * f) >> 8;
+	u32 g = ((a & 0x00ff00) * (256 - f) + (b & 0x00ff00) * f) >> 8;
+
+	return (rb & 0xff00ff) | (g & 0x00ff00);
+}
+
+/* source position of window pixel i in 16.16, centres lined up */
+static inline long src_pos(int i, int src, int dst)
+{
+	long p = ((2L * i + 1) * src << 16) / (2 * dst) - 0x8000;
+
+	return MIN(MAX(p, 0), (long)(src - 1) << 16);
+}
+
+/*
+ * Scale the render box r up into the image, turning r into the window box
+ * it covered. Nothing to do when fb is the image.
+ */
+static void fb_upscale(struct dbx *d, struct dbx_box *r)
+{
+	int rw = d->width, rh = d->height;
+	int ww = d->win_width, wh = d->win_height;
+	int x, y, x1, y1, x2, y2, sx, sy;
+	u32 *src, *src2, *dst;
+	long p;
+
+	if (d->fb == d->out)
+		return;
+
+	/* filtered pixels also read their neighbours */
+	x1 = MAX(r->x1 - d->bilinear, 0);
+	y1 = MAX(r->y1 - d->bilinear, 0);
+	x2 = MIN(r->x2 + d->bilinear, rw - 1);
+	y2 = MIN(r->y2 + d->bilinear, rh - 1);
+	r->x1 = x1 * ww / rw;
+	r->y1 = y1 * wh / rh;
+	r->x2 = MIN(((x2 + 1) * ww + rw - 1) / rw, ww) - 1;
+	r->y2 = MIN(((y2 + 1) * wh + rh - 1) / rh, wh) - 1;
+
+	for (y = r->y1; y <= r->y2; y++) {
+		dst = &d->out[y * d->out_stride];
+		if (!d->bilinear) {
+			src = &d->fb[(y * rh / wh) * d->fb_stride];
+			for (x = r->x1; x <= r->x2; x++)
+				dst[x] = src[x * rw / ww];
+			continue;
+		}
+
+		p = src_pos(y, rh, wh);
+		sy = (p >> 8) & 0xff;
+		src = &d->fb[(p >> 16) * d->fb_stride];
+		src2 = (p >> 16) < rh - 1 ? src + d->fb_stride : src;
+		for (x = r->x1; x <= r->x2; x++) {
+			p = src_pos(x, rw, ww);
+			sx = p >> 16;
+			if (sx < rw - 1)
+				dst[x] = lerp_rgb(lerp_rgb(src[sx], src[sx + 1], (p >> 8) & 0xff),
+						  lerp_rgb(src2[sx], src2[sx + 1], (p >> 8) & 0xff),
+						  sy);
+			else
+				dst[x] = lerp_rgb(src[sx], src2[sx], sy);
+		}
+	}
+}
+
+static void fb_present(struct dbx *d, struct dbx_damage *dm)
+{
+	struct dbx_box b, *r;
+	int i, w, h;
+
+	if (d->headless) {
+		if (d->ppm) {
+			for (i = 0; i < dm->cnt; i++) {
+				b = dm->r[i];
+				fb_upscale(d, &b);
+			}
+			fb_dump(d);
+		}
+		return;
+	}
+
+	for (i = 0; i < dm->cnt; i++) {
+		b = dm->r[i];
+		r = &b;
+		fb_upscale(d, r);
+		w = r->x2 - r->x1 + 1;
+		h = r->y2 - r->y1 + 1;
+		if (d->shm_ok)
+			XShmPutImage(d->display, d->win, d->gc, d->img, r->x1, r->y1,
+				     r->x1, r->y1, w, h, False);
+		else
+			XPutImage(d->display, d->win, d->gc, d->img, r->x1, r->y1,
+				  r->x1, r->y1, w, h);
+	}
+
+	/* only strings are batched in this mode, they stay until blanked */
+	batch_flush(d, d->win);
+
+	/* the server must be done reading the segment before update writes */
+	if (d->shm_ok)
+		XSync(d->display, False);
+}
+
+u32 *dbx_framebuffer(struct dbx *d)
+{
+	/* direct writes can land anywhere */
+	damage_full(d, &d->damage);
+	damage_full(d, &d->drawn);
+
+	if (d->fb_mode)
+		return d->fb;
+
+	if (fb_init(d)) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		fb_deinit(d);
+		return NULL;
+	}
+	/* anything recorded for the pixmap won't be shown any more */
+	batch_reset(d);
+	d->fb_mode = 1;
+	return d->fb;
+}
+
+int dbx_stride(struct dbx *d)
+{
+	return d->fb_stride;
+}
+
+static void fb_fill(struct dbx *d, int x, int y, int wd, int ht, u32 rgb)
+{
+	int x2 = MIN(x + wd, d->clip.x2 + 1);
+	int y2 = MIN(y + ht, d->clip.y2 + 1);
+	u32 *p;
+	int i;
+
+	x = MAX(x, d->clip.x1);
+	y = MAX(y, d->clip.y1);
+	for (; y < y2; y++)
+		for (i = x, p = &d->fb[y * d->fb_stride]; i < x2; i++)
+			p[i] = rgb;
+}
+
+static void fb_line(struct dbx *d, int x1, int y1, int x2, int y2, u32 rgb)
+{
+	int dx = abs(x2 - x1), sx = x1 < x2 ? 1 : -1;
+	int dy = -abs(y2 - y1), sy = y1 < y2 ? 1 : -1;
+	int err = dx + dy, e2;
+
+	for ( ;; ) {
+		if (x1 >= d->clip.x1 && y1 >= d->clip.y1 &&
+		    x1 <= d->clip.x2 && y1 <= d->clip.y2)
+			d->fb[y1 * d->fb_stride + x1] = rgb;
+		if (x1 == x2 && y1 == y2)
+			break;
+		e2 = 2 * err;
+		if (e2 >= dy) {
+			err += dy;
+			x1 += sx;
+		}
+		if (e2 <= dx) {
+			err += dx;
+			y1 += sy;
+		}
+	}
+}
+
+static void fb_circle(struct dbx *d, int x, int y, int dia, u32 rgb)
+{
+	float r = dia / 2.0f;
+	float cx = x + r, cy = y + r;
+	float dy, h;
+	int i, x1, x2;
+
+	for (i = y; i < y + dia; i++) {
+		dy = i + 0.5f - cy;
+		h = r * r - dy * dy;
+		if (h < 0.0f)
+			continue;
+		h = sqrtf(h);
+		x1 = (int)ceilf(cx - h - 0.5f);
+		x2 = (int)floorf(cx + h - 0.5f);
+		fb_fill(d, x1, i, x2 - x1 + 1, 1, rgb);
+	}
+}
+
+/******************************************************************************/
+
+/*
+ * Primitives are recorded per color during ops->update and flushed at present
+ * time, one X request per kind and color. A color's batch can only be reused
+ * if the new primitive doesn't overlap a batch recorded after it, otherwise
+ * painting order would change; in that case a new batch is started.
+ */
+
+static void *vec_add(struct dbx_vec *v, size_t esz)
+{
+	void *p;
+	int sz;
+
+	if (v->cnt == v->sz) {
+		sz = v->sz ? v->sz * 2 : 64;
+		p = realloc(v->p, sz * esz);
+		if (!p)
+			return NULL;
+		v->p = p;
+		v->sz = sz;
+	}
+	return (char *)v->p + esz * v->cnt++;
+}
+
+static int box_overlap(struct dbx_box *a, struct dbx_box *b)
+{
+	return a->x1 <= b->x2 && b->x1 <= a->x2 &&
+	       a->y1 <= b->y2 && b->y1 <= a->y2;
+}
+
+static void batch_reset(struct dbx *d)
+{
+	struct dbx_batch *b;
+	int i;
+
+	for (i = 0; i < d->batch_cnt; i++) {
+		b = &d->batch[i];
+		b->fill.cnt = b->rect.cnt = b->arc.cnt = 0;
+		b->seg.cnt = b->pt.cnt = b->text.cnt = 0;
+	}
+	d->batch_cnt = 0;
+}
+
+static void batch_free(struct dbx *d)
+{
+	struct dbx_batch *b;
+	int i;
+
+	for (i = 0; i < BATCH_CNT; i++) {
+		b = &d->batch[i];
+		free(b->fill.p);
+		free(b->rect.p);
+		free(b->arc.p);
+		free(b->seg.p);
+		free(b->pt.p);
+		free(b->text.p);
+	}
+	memset(d->batch, 0, sizeof(d->batch));
+	d->batch_cnt = 0;
+}
+
+static void batch_flush(struct dbx *d, Drawable dst)
+{
+	struct dbx_batch *b;
+	struct dbx_text *t;
+	int i, j;
+
+	for (i = 0; i < d->batch_cnt; i++) {
+		b = &d->batch[i];
+		dbx_set_foreground(d, b->rgb);
+		if (b->fill.cnt)
+			XFillRectangles(d->display, dst, d->gc, b->fill.p, b->fill.cnt);
+		if (b->arc.cnt)
+			XFillArcs(d->display, dst, d->gc, b->arc.p, b->arc.cnt);
+		if (b->rect.cnt)
+			XDrawRectangles(d->display, dst, d->gc, b->rect.p, b->rect.cnt);
+		if (b->seg.cnt)
+			XDrawSegments(d->display, dst, d->gc, b->seg.p, b->seg.cnt);
+		if (b->pt.cnt)
+			XDrawPoints(d->display, dst, d->gc, b->pt.p, b->pt.cnt,
+				    CoordModeOrigin);
+		/* strings over a scaled framebuffer go straight to the window */
+		for (j = 0, t = b->text.p; j < b->text.cnt; j++, t++)
+			XDrawString(d->display, dst, d->gc,
+				    t->x * d->win_width / d->width,
+				    t->y * d->win_height / d->height, t->s, t->len);
+	}
+}
+
+/* the batch for rgb that a primitive covering box can go into, NULL if culled */
+static struct dbx_batch *batch_get(struct dbx *d, u32 rgb, struct dbx_box *box)
+{
+	struct dbx_batch *b;
+	int i;
+
+	if (!dbx_box_add(d, box))
+		return NULL;
+
+	for (i = d->batch_cnt - 1; i >= 0; i--) {
+		b = &d->batch[i];
+		if (b->rgb == rgb)
+			goto found;
+		if (box_overlap(&b->box, box))
+			break;
+	}
+
+	if (d->batch_cnt == BATCH_CNT) {
+		/* strings over a framebuffer have nowhere else to go */
+		if (d->fb_mode)
+			return NULL;
+		batch_flush(d, d->pixmap);
+		batch_reset(d);
+	}
+	b = &d->batch[d->batch_cnt++];
+	b->rgb = rgb;
+	b->box = *box;
+	return b;
+
+found:
+	b->box.x1 = MIN(b->box.x1, box->x1);
+	b->box.y1 = MIN(b->box.y1, box->y1);
+	b->box.x2 = MAX(b->box.x2, box->x2);
+	b->box.y2 = MAX(b->box.y2, box->y2);
+	return b;
+}
+
+static void batch_fill(struct dbx *d, int x, int y, int wd, int ht, u32 rgb)
+{
+	struct dbx_box box = { x, y, x + wd - 1, y + ht - 1 };
+	struct dbx_batch *b;
+	XRectangle *r;
+
+	if (wd <= 0 || ht <= 0)
+		return;
+	b = batch_get(d, rgb, &box);
+	if (!b || !(r = vec_add(&b->fill, sizeof(*r))))
+		return;
+	r->x = x;
+	r->y = y;
+	r->width = wd;
+	r->height = ht;
+}
+
+static void batch_rect(struct dbx *d, int x, int y, int wd, int ht, u32 rgb)
+{
+	struct dbx_box box = { x, y, x + wd, y + ht };
+	struct dbx_batch *b;
+	XRectangle *r;
+
+	if (wd < 0 || ht < 0)
+		return;
+	b = batch_get(d, rgb, &box);
+	if (!b || !(r = vec_add(&b->rect, sizeof(*r))))
+		return;
+	r->x = x;
+	r->y = y;
+	r->width = wd;
+	r->height = ht;
+}
+
+static void batch_arc(struct dbx *d, int x, int y, int dia, u32 rgb)
+{
+	struct dbx_box box = { x, y, x + dia, y + dia };
+	struct dbx_batch *b;
+	XArc *a;
+
+	if (dia <= 0)
+		return;
+	b = batch_get(d, rgb, &box);
+	if (!b || !(a = vec_add(&b->arc, sizeof(*a))))
+		return;
+	a->x = x;
+	a->y = y;
+	a->width = a->height = dia;
+	a->angle1 = 0;
+	a->angle2 = 360 * 64;
+}
+
+static void batch_seg(struct dbx *d, int x1, int y1, int x2, int y2, u32 rgb)
+{
+	struct dbx_box box = { MIN(x1, x2), MIN(y1, y2), MAX(x1, x2), MAX(y1, y2) };
+	struct dbx_batch *b;
+	XSegment *s;
+
+	b = batch_get(d, rgb, &box);
+	if (!b || !(s = vec_add(&b->seg, sizeof(*s))))
+		return;
+	s->x1 = x1;
+	s->y1 = y1;
+	s->x2 = x2;
+	s->y2 = y2;
+}
+
+static void batch_point(struct dbx *d, int x, int y, u32 rgb)
+{
+	struct dbx_box box = { x, y, x, y };
+	struct dbx_batch *b;
+	XPoint *p;
+
+	b = batch_get(d, rgb, &box);
+	if (!b || !(p = vec_add(&b->pt, sizeof(*p))))
+		return;
+	p->x = x;
+	p->y = y;
+}
+
+static void batch_text(struct dbx *d, int x, int y, const char *s, size_t len,
+		       u32 rgb)
+{
+	struct dbx_box box;
+	struct dbx_batch *b;
+	struct dbx_text *t;
+
+	if (d->headless)
+		return;
+
+	len = MIN(len, TEXT_LEN);
+	box.x1 = x;
+	box.y1 = y - d->font->ascent;
+	box.x2 = x + XTextWidth(d->font, s, len);
+	box.y2 = y + d->font->descent;
+
+	b = batch_get(d, rgb, &box);
+	if (!b || !(t = vec_add(&b->text, sizeof(*t))))
+		return;
+	t->x = x;
+	t->y = y;
+	t->len = len;
+	memcpy(t->s, s, len);
+}
+
+/******************************************************************************/
+
+static int recording(struct dbx *d);
+static int layer_add(struct dbx *d, int op, int a, int b, int c, int e,
+		     u32 rgb, struct dbx_box *box);
+static int layer_string(struct dbx *d, int x, int y, const char *s,
+			size_t len, u32 rgb);
+static int layer_image(struct dbx *d, struct dbx_image *im,
+		       struct dbx_box *box);
+
+int dbx_draw_rectangle(struct dbx *d, int x, int y, int wd, int ht, u32 rgb)
+{
+	struct dbx_box box = { x, y, x + wd, y + ht };
+
+	if (recording(d))
+		return wd < 0 || ht < 0 ? 0 :
+		       layer_add(d, CMD_RECT, x, y, wd, ht, rgb, &box);
+	if (d->fb_mode) {
+		if (!dbx_box_add(d, &box))
+			return 0;
+		fb_fill(d, x, y, wd + 1, 1, rgb);
+		fb_fill(d, x, y + ht, wd + 1, 1, rgb);
+		fb_fill(d, x, y + 1, 1, ht - 1, rgb);
+		fb_fill(d, x + wd, y + 1, 1, ht - 1, rgb);
+		return 0;
+	}
+	batch_rect(d, x, y, wd, ht, rgb);
+	return 0;
+}
+
+int dbx_fill_rectangle(struct dbx *d, int x, int y, int wd, int ht, u32 rgb)
+{
+	struct dbx_box box = { x, y, x + wd - 1, y + ht - 1 };
+
+	if (recording(d))
+		return wd <= 0 || ht <= 0 ? 0 :
+		       layer_add(d, CMD_FILL, x, y, wd, ht, rgb, &box);
+	if (d->fb_mode) {
+		if (wd <= 0 || ht <= 0 || !dbx_box_add(d, &box))
+			return 0;
+		fb_fill(d, x, y, wd, ht, rgb);
+		return 0;
+	}
+	batch_fill(d, x, y, wd, ht, rgb);
+	return 0;
+}
+
+int dbx_blank_pixmap(struct dbx *d)
+{
+	struct dbx_damage drawn = d->drawn;
+	struct dbx_box *r;
+	int i;
+
+	/* layers are cleared as they are composited */
+	if (d->layer >= 0)
+		return 0;
+
+	/* everything recorded so far lies in the drawn area being cleared */
+	batch_reset(d);
+
+	for (i = 0; i < drawn.cnt; i++) {
+		r = &drawn.r[i];
+		dbx_fill_rectangle(d, r->x1, r->y1, r->x2 - r->x1 + 1,
+				   r->y2 - r->y1 + 1, RGB(0, 0, 0));
+	}
+	d->drawn.cnt = 0;
+	return 0;
+}
+
+int dbx_draw_string(struct dbx *d, int x, int y, const char *s, size_t len,
+		    u32 rgb)
+{
+	if (recording(d))
+		return layer_string(d, x, y, s, len, rgb);
+	batch_text(d, x, y, s, len, rgb);
+	return 0;
+}
+
+int dbx_fill_circle(struct dbx *d, int x, int y, int dia, u32 rgb)
+{
+	struct dbx_box box = { x, y, x + dia, y + dia };
+
+	if (recording(d))
+		return dia <= 0 ? 0 :
+		       layer_add(d, CMD_CIRCLE, x, y, dia, 0, rgb, &box);
+	if (d->fb_mode) {
+		if (!dbx_box_add(d, &box))
+			return 0;
+		fb_circle(d, x, y, dia, rgb);
+		return 0;
+	}
+	batch_arc(d, x, y, dia, rgb);
+	return 0;
+}
+
+int dbx_draw_point(struct dbx *d, int x, int y, u32 rgb)
+{
+	struct dbx_box box = { x, y, x, y };
+
+	if (recording(d))
+		return layer_add(d, CMD_POINT, x, y, 0, 0, rgb, &box);
+	if (d->fb_mode) {
+		if (dbx_box_add(d, &box))
+			d->fb[y * d->fb_stride + x] = rgb;
+		return 0;
+	}
+	batch_point(d, x, y, rgb);
+	return 0;
+}
+
+int dbx_draw_line(struct dbx *d, int x1, int y1, int x2, int y2, u32 rgb)
+{
+	struct dbx_box box = { MIN(x1, x2), MIN(y1, y2), MAX(x1, x2), MAX(y1, y2) };
+
+	if (recording(d))
+		return layer_add(d, CMD_LINE, x1, y1, x2, y2, rgb, &box);
+	if (d->fb_mode) {
+		if (!dbx_box_add(d, &box))
+			return 0;
+		fb_line(d, x1, y1, x2, y2, rgb);
+		return 0;
+	}
+	batch_seg(d, x1, y1, x2, y2, rgb);
+	return 0;
+}
+
+/* the part of im in box, which is already clipped */
+static void fb_image(struct dbx *d, struct dbx_image *im, struct dbx_box *box)
+{
+	int x, y, w = box->x2 - box->x1 + 1;
+	const u32 *src;
+	u32 *dst;
+
+	for (y = box->y1; y <= box->y2; y++) {
+		dst = &d->fb[y * d->fb_stride + box->x1];
+		src = &im->px[(y - im->y) * im->stride + box->x1 - im->x];
+		for (x = 0; x < w; x++)
+			dst[x] |= src[x];
+	}
+}
+
+static void x_image(struct dbx *d, struct dbx_image *im, struct dbx_box *box)
+{
+	Visual *vis = DefaultVisual(d->display, d->screen);
+	int depth = DefaultDepth(d->display, d->screen);
+	static int warned;
+	XImage *img;
+
+	img = XCreateImage(d->display, vis, depth, ZPixmap, 0, (char *)im->px,
+			   im->wd, im->ht, 32, im->stride * sizeof(u32));
+	if (!img)
+		return;
+	if (img->bits_per_pixel != 32 || img->red_mask != 0xff0000 ||
+	    img->green_mask != 0x00ff00 || img->blue_mask != 0x0000ff) {
+		if (!warned++)
+			printf("%s:%d %s() unsupported visual\n",
+			       __FILE__, __LINE__, __func__);
+		goto exit;
+	}
+
+	/* after whatever was drawn before it */
+	batch_flush(d, d->pixmap);
+	batch_reset(d);
+
+	XSetFunction(d->display, d->gc, GXor);
+	XPutImage(d->display, d->pixmap, d->gc, img, box->x1 - im->x,
+		  box->y1 - im->y, box->x1, box->y1, box->x2 - box->x1 + 1,
+		  box->y2 - box->y1 + 1);
+	XSetFunction(d->display, d->gc, GXcopy);
+exit:
+	img->data = NULL;
+	XDestroyImage(img);
+}
+
+int dbx_draw_image(struct dbx *d, int x, int y, int wd, int ht,
+		   const u32 *px, int stride)
+{
+	struct dbx_image im = { x, y, wd, ht, px, stride };
+	struct dbx_box box = { x, y, x + wd - 1, y + ht - 1 };
+
+	if (wd <= 0 || ht <= 0)
+		return 0;
+	if (recording(d))
+		return layer_image(d, &im, &box);
+	if (!dbx_box_add(d, &box))
+		return 0;
+	if (d->fb_mode)
+		fb_image(d, &im, &box);
+	else
+		x_image(d, &im, &box);
+	return 0;
+}
+
+/******************************************************************************/
+
+/*
+ * Layers keep their drawing calls and replay them at present, clipped to
+ * each box of the area that changed: old and new extents of the layers
+ * drawn since the last present. The background is rendered once per change
+ * over black and kept as an image (a pixmap, or a buffer in framebuffer
+ * mode) for the other layers to be replayed over; strings in framebuffer
+ * mode aren't pixels, so its strings are replayed too.
+ */
+
+static int recording(struct dbx *d)
+{
+	return d->layer >= 0 && !d->composing;
+}
+
+static int layer_add(struct dbx *d, int op, int a, int b, int c, int e,
+		     u32 rgb, struct dbx_box *box)
+{
+	struct dbx_layer *l = &d->layers[d->layer];
+	struct dbx_cmd *cmd;
+
+	if (!box_clip(d, box) || !(cmd = vec_add(&l->cmd, sizeof(*cmd))))
+		return 0;
+	cmd->op = op;
+	cmd->v[0] = a;
+	cmd->v[1] = b;
+	cmd->v[2] = c;
+	cmd->v[3] = e;
+	cmd->rgb = rgb;
+	cmd->box = *box;
+
+	damage_add(&l->ext, box);
+	l->changed = 1;
+	return 0;
+}
+
+static int layer_string(struct dbx *d, int x, int y, const char *s,
+			size_t len, u32 rgb)
+{
+	struct dbx_layer *l = &d->layers[d->layer];
+	struct dbx_text *t;
+	struct dbx_box box;
+
+	if (d->headless)
+		return 0;
+
+	len = MIN(len, TEXT_LEN);
+	box.x1 = x;
+	box.y1 = y - d->font->ascent;
+	box.x2 = x + XTextWidth(d->font, s, len);
+	box.y2 = y + d->font->descent;
+
+	if (!(t = vec_add(&l->text, sizeof(*t))))
+		return 0;
+	t->x = x;
+	t->y = y;
+	t->len = len;
+	memcpy(t->s, s, len);
+	return layer_add(d, CMD_STRING, l->text.cnt - 1, 0, 0, 0, rgb, &box);
+}
+
+static int layer_image(struct dbx *d, struct dbx_image *im,
+		       struct dbx_box *box)
+{
+	struct dbx_layer *l = &d->layers[d->layer];
+	struct dbx_image *p;
+
+	if (!(p = vec_add(&l->img, sizeof(*p))))
+		return 0;
+	*p = *im;
+	return layer_add(d, CMD_IMAGE, l->img.cnt - 1, 0, 0, 0, 0, box);
+}
+
+/* what layer l keeps over r, or just its strings */
+static void layer_replay(struct dbx *d, struct dbx_layer *l,
+			 struct dbx_box *r, int strings)
+{
+	struct dbx_cmd *c = l->cmd.p;
+	struct dbx_image *im;
+	struct dbx_text *t;
+	int i, *v;
+
+	for (i = 0; i < l->cmd.cnt; i++, c++) {
+		if (!box_overlap(&c->box, r) || (strings && c->op != CMD_STRING))
+			continue;
+
+		v = c->v;
+		switch (c->op) {
+		case CMD_FILL:
+			dbx_fill_rectangle(d, v[0], v[1], v[2], v[3], c->rgb);
+			break;
+		case CMD_RECT:
+			dbx_draw_rectangle(d, v[0], v[1], v[2], v[3], c->rgb);
+			break;
+		case CMD_CIRCLE:
+			dbx_fill_circle(d, v[0], v[1], v[2], c->rgb);
+			break;
+		case CMD_STRING:
+			t = (struct dbx_text *)l->text.p + v[0];
+			dbx_draw_string(d, t->x, t->y, t->s, t->len, c->rgb);
+			break;
+		case CMD_POINT:
+			dbx_draw_point(d, v[0], v[1], c->rgb);
+			break;
+		case CMD_LINE:
+			dbx_draw_line(d, v[0], v[1], v[2], v[3], c->rgb);
+			break;
+		case CMD_IMAGE:
+			im = (struct dbx_image *)l->img.p + v[0];
+			dbx_draw_image(d, im->x, im->y, im->wd, im->ht, im->px,
+				       im->stride);
+			break;
+		}
+	}
+}
+
+/* the whole background over black, drawn into the frame and kept from there */
+static int bg_render(struct dbx *d)
+{
+	struct dbx_layer *l = &d->layers[DBX_LAYER_BG];
+	int depth;
+
+	if (d->fb_mode) {
+		if (!d->bg_fb)
+			d->bg_fb = malloc(d->fb_stride * d->win_height * sizeof(u32));
+		if (!d->bg_fb)
+			return -1;
+		fb_fill(d, 0, 0, d->width, d->height, RGB(0, 0, 0));
+		layer_replay(d, l, &d->clip, 0);
+		batch_reset(d);
+		memcpy(d->bg_fb, d->fb, d->fb_stride * d->height * sizeof(u32));
+		return 0;
+	}
+
+	if (!d->bg) {
+		depth = DefaultDepth(d->display, d->screen);
+		d->bg = XCreatePixmap(d->display, d->win, d->width, d->height,
+				      depth);
+	}
+	dbx_set_foreground(d, RGB(0, 0, 0));
+	XFillRectangle(d->display, d->pixmap, d->gc, 0, 0, d->width, d->height);
+	layer_replay(d, l, &d->clip, 0);
+	batch_flush(d, d->pixmap);
+	batch_reset(d);
+	XCopyArea(d->display, d->pixmap, d->bg, d->gc, 0, 0, d->width,
+		  d->height, 0, 0);
+	return 0;
+}
+
+/* r of the frame: the background, then the layers over it */
+static void compose_box(struct dbx *d, struct dbx_box *r)
+{
+	int w = r->x2 - r->x1 + 1, h = r->y2 - r->y1 + 1;
+	XRectangle xr = { r->x1, r->y1, w, h };
+	int i, y;
+
+	d->clip = *r;
+	if (d->fb_mode) {
+		for (y = r->y1; y <= r->y2; y++)
+			memcpy(&d->fb[y * d->fb_stride + r->x1],
+			       &d->bg_fb[y * d->fb_stride + r->x1],
+			       w * sizeof(u32));
+		layer_replay(d, &d->layers[DBX_LAYER_BG], r, 1);
+	} else {
+		XSetClipRectangles(d->display, d->gc, 0, 0, &xr, 1, Unsorted);
+		XCopyArea(d->display, d->bg, d->pixmap, d->gc, r->x1, r->y1,
+			  w, h, r->x1, r->y1);
+	}
+
+	for (i = DBX_LAYER_BG + 1; i < DBX_LAYERS; i++)
+		layer_replay(d, &d->layers[i], r, 0);
+
+	if (!d->fb_mode) {
+		batch_flush(d, d->pixmap);
+		batch_reset(d);
+		XSetClipMask(d->display, d->gc, None);
+	}
+	clip_full(d);
+}
+
+static void layers_compose(struct dbx *d, int full)
+{
+	struct dbx_damage dm = { .cnt = 0 };
+	struct dbx_layer *l;
+	int i, j;
+
+	d->composing = 1;
+	batch_reset(d);
+
+	/* a new background is all over the frame */
+	if (!d->bg_ok || d->layers[DBX_LAYER_BG].changed) {
+		if (bg_render(d)) {
+			printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+			goto exit;
+		}
+		d->bg_ok = 1;
+		full = 1;
+	}
+
+	for (i = 0; i < DBX_LAYERS; i++) {
+		l = &d->layers[i];
+		for (j = 0; l->changed && j < l->shown.cnt; j++)
+			damage_add(&dm, &l->shown.r[j]);
+		for (j = 0; l->changed && j < l->ext.cnt; j++)
+			damage_add(&dm, &l->ext.r[j]);
+		l->shown = l->ext;
+		l->changed = 0;
+	}
+	if (full)
+		damage_full(d, &dm);
+
+	for (i = 0; i < dm.cnt; i++) {
+		compose_box(d, &dm.r[i]);
+		damage_add(&d->damage, &dm.r[i]);
+	}
+exit:
+	d->composing = 0;
+}
+
+static void layers_free(struct dbx *d)
+{
+	struct dbx_layer *l;
+	int i;
+
+	for (i = 0; i < DBX_LAYERS; i++) {
+		l = &d->layers[i];
+		free(l->cmd.p);
+		free(l->text.p);
+		free(l->img.p);
+	}
+	if (d->bg)
+		XFreePixmap(d->display, d->bg);
+	free(d->bg_fb);
+}
+
+int dbx_layer(struct dbx *d, int layer)
+{
+	struct dbx_layer *l = &d->layers[layer];
+	int i;
+
+	if (d->layer < 0)
+		for (i = 0; i < DBX_LAYERS; i++)
+			d->layers[i].dirty = 1;
+	d->layer = layer;
+	if (!l->dirty)
+		return 0;
+
+	l->cmd.cnt = l->text.cnt = l->img.cnt = 0;
+	l->ext.cnt = 0;
+	l->dirty = 0;
+	l->changed = 1;
+	return 1;
+}
+
+void dbx_layer_dirty(struct dbx *d, int layer)
+{
+	d->layers[layer].dirty = 1;
+}
+
+int dbx_width(struct dbx *d)
+{
+	return d->width;
+}
+
+int dbx_height(struct dbx *d)
+{
+	return d->height;
+}
+
+/* events handled since the last update */
+int dbx_event_count(struct dbx *d)
+{
+	return d->events;
+}
+
+/* every motion sample since the last update, with DBX_MOTION_HISTORY */
+int dbx_motion_history(struct dbx *d, const XTimeCoord **h)
+{
+	*h = d->motion.p;
+	return d->motion.cnt;
+}
+
+/* render size over window size, below 1 when DBX_DYNRES is catching up */
+float dbx_render_scale(struct dbx *d)
+{
+	return d->scale;
+}
+
+/* input arrived since the last update, or there is no input to wait for */
+int dbx_dirty(struct dbx *d)
+{
+	return d->dirty || d->headless;
+}
+
+float dbx_fps(struct dbx *d)
+{
+	return d->fps;
 }
@@ -32,6 +32,12 @@ void int_mod(int *v, int min, int max, int delta);
 
 struct dbx;
 
+/* returned by update when it left the pixmap untouched */
+#define DBX_IDLE	1
+
+/* dbx_ops flags */
+#define DBX_MOTION_HISTORY	(1 << 0)	/* keep coalesced motion samples */
+
 struct dbx_ops {
 	int (*init)(struct dbx *);
 	int (*update)(struct dbx *);
@@ -39,12 +45,18 @@ struct dbx_ops {
 	int (*configure)(struct dbx *, XConfigureEvent *);
 	int (*key)(struct dbx *, int , int , int );
 	int (*button)(struct dbx *, int button, int x, int y, int press);
+	int flags;
 };
 
 void dbx_run(int argc, char *argv[], struct dbx_ops *ops, u32 t_ms);
 
 int dbx_width(struct dbx *d);
 int dbx_height(struct dbx *d);
+float dbx_fps(struct dbx *d);
+float dbx_render_scale(struct dbx *d);
+int dbx_dirty(struct dbx *d);
+int dbx_event_count(struct dbx *d);
+int dbx_motion_history(struct dbx *d, const XTimeCoord **h);
 
 int dbx_blank_pixmap(struct dbx *d);
 int dbx_fill_rectangle(struct dbx *d, int x, int y, int wd, int ht, u32 rgb);
@@ -53,3 +65,28 @@ int dbx_fill_circle(struct dbx *d, int x, int y, int dia, u32 rgb);
 int dbx_draw_string(struct dbx *d, int x, int y, const char *s, size_t len, u32 rgb);
 int dbx_draw_point(struct dbx *d, int x, int y, u32 rgb);
 int dbx_draw_line(struct dbx *d, int x1, int y1, int x2, int y2, u32 rgb);
+
+/*
+ * RGB() pixels, stride u32s per row, ORed into what is below so black ones
+ * let it show. They are read again whenever a layer holding them is
+ * composited, until the layer is redrawn.
+ */
+int dbx_draw_image(struct dbx *d, int x, int y, int wd, int ht,
+		   const u32 *px, int stride);
+
+/* switch to framebuffer mode: RGB() pixels, dbx_stride() u32s per row */
+u32 *dbx_framebuffer(struct dbx *d);
+int dbx_stride(struct dbx *d);
+
+/*
+ * Layers, composited bottom to top at present. Once an app selects one,
+ * drawing goes into the selected layer and stays there until the layer is
+ * marked dirty: dbx_layer() then empties it and returns 1 for the app to
+ * draw it again, else 0 and what it holds is kept. Only the area of layers
+ * that changed is composited. All start out dirty, and become dirty again
+ * when the render size changes. dbx_blank_pixmap() does nothing for them.
+ */
+enum { DBX_LAYER_BG, DBX_LAYER_MAIN, DBX_LAYER_HUD, DBX_LAYERS };
+
+int  dbx_layer(struct dbx *d, int layer);
+void dbx_layer_dirty(struct dbx *d, int layer);
@@ -0,0 +1,82 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "density.h"
+
+#define MAX(x, y)	(((x) > (y)) ? (x) : (y))
+
+/* the wrap around of the differences cancels out in the sums */
+void density_add(uint16_t *h, int ht, const float *y, int n)
+{
+	float v, m0, m1, lo, hi;
+	int c;
+
+	for (c = 0; c < n; c++, h += ht + 1) {
+		v = y[c];
+		if (isnan(v))
+			continue;
+
+		/* a NaN neighbour fails the compares and is passed over */
+		m0 = (y[c - 1] + v) * 0.5f;
+		m1 = (v + y[c + 1]) * 0.5f;
+		lo = m0 < v ? m0 : v;
+		lo = m1 < lo ? m1 : lo;
+		hi = m0 > v ? m0 : v;
+		hi = m1 > hi ? m1 : hi;
+
+		/* off either end, the two land on the same count */
+		lo = lo > 0.0f ? lo : 0.0f;
+		lo = lo < ht ? lo : ht;
+		hi = hi > -1.0f ? hi : -1.0f;
+		hi = hi < ht - 1 ? hi : ht - 1;
+		h[(int)(lo + 0.5f)]++;
+		h[(int)(hi + 1.5f)]--;
+	}
+}
+
+void density_sum(uint16_t *h, int ht, int n)
+{
+	int c, i;
+
+	for (c = 0; c < n; c++, h += ht + 1)
+		for (i = 1; i < ht; i++)
+			h[i] += h[i - 1];
+}
+
+static uint32_t ramp(float f, uint32_t clr)
+{
+	uint32_t rgb = 0;
+	float c;
+	int k;
+
+	for (k = 0; k < 24; k += 8) {
+		c = (clr >> k) & 0xff;
+		c = f < 0.5f ? c * 2.0f * f : c + (255.0f - c) * (2.0f * f - 1.0f);
+		rgb |= (uint32_t)c << k;
+	}
+	return rgb;
+}
+
+void density_tone(uint32_t *img, const uint16_t *h, int wd, int ht,
+		  uint32_t clr)
+{
+	static uint32_t lut[UINT16_MAX + 1];
+	int i, x, y, max = 0;
+	const uint16_t *p;
+	float s;
+
+	for (x = 0, p = h; x < wd; x++, p += ht + 1)
+		for (y = 0; y < ht; y++)
+			max = MAX(max, p[y]);
+
+	s = 1.0f / log1pf(MAX(max, 1));
+	for (i = 0; i <= max; i++)
+		lut[i] = ramp(log1pf(i) * s, clr);
+
+	/* a row at a time, across the columns */
+	for (y = 0; y < ht; y++)
+		for (x = 0, p = h + y; x < wd; x++, p += ht + 1)
+			*img++ = lut[*p];
+}
@@ -0,0 +1,23 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+/*
+ * Curve density: hit counts per pixel, stored a column after the other,
+ * ht + 1 apart, and their tone mapping to RGB() pixels on a log scale.
+ * While curves are added a column holds differences, one up where a span
+ * starts and one down past its end, so a span costs two stores whatever
+ * its length; density_sum() turns them into counts.
+ */
+
+#include <stdint.h>
+
+/*
+ * One curve through n columns, y[c] its screen y in column c, with y[-1]
+ * and y[n] the columns either side. Each column gets the span from midway
+ * to one neighbour to midway to the other, NaN ends the curve.
+ */
+void density_add(uint16_t *h, int ht, const float *y, int n);
+void density_sum(uint16_t *h, int ht, int n);
+
+/* black to clr over the lower half of the log range, on to white above */
+void density_tone(uint32_t *img, const uint16_t *h, int wd, int ht,
+		  uint32_t clr);
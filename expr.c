@@ -0,0 +1,955 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "expr.h"
+#include "vmath.h"
+
+/*
+ * The parser builds a DAG of nodes, folding constants and sharing identical
+ * subexpressions as it goes. Code generation turns the nodes still reachable
+ * into three address instructions over registers of BLOCK floats, operands
+ * that are constants become immediates where an op has a K form, and a
+ * linear scan over last uses keeps the register count down. Evaluation runs
+ * each instruction over a whole block at a time, mostly through vmath.
+ */
+
+enum {
+	OP_CONST, OP_X, OP_Y, OP_T,
+	/* unary */
+	OP_NEG, OP_SIN, OP_COS, OP_TAN, OP_EXP, OP_LOG, OP_SQRT, OP_ABS,
+	/* binary */
+	OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW, OP_MIN, OP_MAX,
+	/* bytecode only, k is the constant operand */
+	OP_LOADK, OP_LOADT, OP_ADDK, OP_SUBK, OP_RSUBK, OP_MULK, OP_DIVK,
+	OP_RDIVK, OP_POWK, OP_MINK, OP_MAXK,
+	OP_CNT
+};
+
+static const char *op_names[OP_CNT] = {
+	"const", "x", "y", "t",
+	"neg", "sin", "cos", "tan", "exp", "log", "sqrt", "abs",
+	"add", "sub", "mul", "div", "pow", "min", "max",
+	"loadk", "loadt", "addk", "subk", "rsubk", "mulk", "divk",
+	"rdivk", "powk", "mink", "maxk",
+};
+
+#define UNARY(op)	((op) >= OP_NEG && (op) <= OP_ABS)
+#define BINARY(op)	((op) >= OP_ADD && (op) <= OP_MAX)
+#define COMMUTES(op)	((op) == OP_ADD || (op) == OP_MUL || \
+			 (op) == OP_MIN || (op) == OP_MAX)
+
+#define MIN(x, y)	(((x) < (y)) ? (x) : (y))
+#define MAX(x, y)	(((x) > (y)) ? (x) : (y))
+
+#define NODE_CNT	256
+#define REG_CNT		64
+#define REG_X		-1
+#define REG_Y		-2	/* the inputs are read where they are */
+#define POWI_MAX	65536	/* whole powers taken as such up to here */
+#define BLOCK		256	/* floats per register, REG_CNT of them fit L2 */
+
+struct node {
+	int op;
+	int a, b;
+	float k;
+};
+
+struct parser {
+	const char *s, *p;
+	struct node n[NODE_CNT];
+	int cnt;
+	int flags;
+	char *err;
+	int err_sz;
+};
+
+struct insn {
+	short op;
+	short dst, a, b;
+	float k;
+};
+
+struct expr {
+	struct insn code[NODE_CNT];
+	int len;
+	int out;
+	int regs;
+	int flags;
+};
+
+static int fail(struct parser *p, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	/* the first error is the one to report */
+	if (p->err[0])
+		return -1;
+
+	va_start(ap, fmt);
+	n = vsnprintf(p->err, p->err_sz, fmt, ap);
+	va_end(ap);
+	if (n >= 0 && n < p->err_sz)
+		snprintf(p->err + n, p->err_sz - n, " at column %d",
+			 (int)(p->p - p->s) + 1);
+	return -1;
+}
+
+static float op1(int op, float a)
+{
+	switch (op) {
+	case OP_NEG:  return -a;
+	case OP_SIN:  return sinf(a);
+	case OP_COS:  return cosf(a);
+	case OP_TAN:  return tanf(a);
+	case OP_EXP:  return expf(a);
+	case OP_LOG:  return logf(a);
+	case OP_SQRT: return sqrtf(a);
+	case OP_ABS:  return fabsf(a);
+	}
+	return NAN;
+}
+
+static float op2(int op, float a, float b)
+{
+	switch (op) {
+	case OP_ADD: return a + b;
+	case OP_SUB: return a - b;
+	case OP_MUL: return a * b;
+	case OP_DIV: return a / b;
+	case OP_POW: return powf(a, b);
+	case OP_MIN: return fminf(a, b);
+	case OP_MAX: return fmaxf(a, b);
+	}
+	return NAN;
+}
+
+static int is_const(struct parser *p, int i, float k)
+{
+	return p->n[i].op == OP_CONST && p->n[i].k == k;
+}
+
+/* the node for op on a and b, folded and shared where possible */
+static int node(struct parser *p, int op, int a, int b, float k)
+{
+	struct node *n;
+	int i;
+
+	if (a < 0 || (BINARY(op) && b < 0))
+		return -1;
+
+	if (UNARY(op) && p->n[a].op == OP_CONST)
+		return node(p, OP_CONST, 0, 0, op1(op, p->n[a].k));
+	if (BINARY(op) && p->n[a].op == OP_CONST && p->n[b].op == OP_CONST)
+		return node(p, OP_CONST, 0, 0, op2(op, p->n[a].k, p->n[b].k));
+
+	if (COMMUTES(op) && (p->n[a].op == OP_CONST ||
+			     (p->n[b].op != OP_CONST && a > b))) {
+		i = a;
+		a = b;
+		b = i;
+	}
+
+	/* identities that hold for every float, NaN and infinities included */
+	if ((op == OP_ADD || op == OP_SUB) && is_const(p, b, 0.0f))
+		return a;
+	if ((op == OP_MUL || op == OP_DIV || op == OP_POW) && is_const(p, b, 1.0f))
+		return a;
+	if (op == OP_NEG && p->n[a].op == OP_NEG)
+		return p->n[a].a;
+
+	if (!UNARY(op) && !BINARY(op))
+		a = b = 0;
+	if (!BINARY(op))
+		b = 0;
+	if (op != OP_CONST)
+		k = 0.0f;
+
+	for (i = 0; i < p->cnt; i++) {
+		n = &p->n[i];
+		if (n->op == op && n->a == a && n->b == b &&
+		    !memcmp(&n->k, &k, sizeof(k)))
+			return i;
+	}
+
+	if (p->cnt == NODE_CNT)
+		return fail(p, "expression too long");
+
+	n = &p->n[p->cnt];
+	n->op = op;
+	n->a = a;
+	n->b = b;
+	n->k = k;
+	return p->cnt++;
+}
+
+/******************************************************************************/
+
+static const struct {
+	const char *name;
+	int op;
+	int args;
+} funcs[] = {
+	{ "sin",  OP_SIN,  1 },
+	{ "cos",  OP_COS,  1 },
+	{ "tan",  OP_TAN,  1 },
+	{ "exp",  OP_EXP,  1 },
+	{ "log",  OP_LOG,  1 },
+	{ "sqrt", OP_SQRT, 1 },
+	{ "abs",  OP_ABS,  1 },
+	{ "pow",  OP_POW,  2 },
+	{ "min",  OP_MIN,  2 },
+	{ "max",  OP_MAX,  2 },
+};
+
+static int parse_expr(struct parser *p);
+static int parse_unary(struct parser *p);
+
+static int peek(struct parser *p)
+{
+	while (isspace((unsigned char)*p->p))
+		p->p++;
+	return (unsigned char)*p->p;
+}
+
+static int expect(struct parser *p, int c)
+{
+	if (peek(p) != c)
+		return fail(p, "expected '%c'", c);
+	p->p++;
+	return 0;
+}
+
+static int parse_call(struct parser *p, const char *name, int len)
+{
+	int i, a, b = 0;
+
+	for (i = 0; i < sizeof(funcs) / sizeof(funcs[0]); i++)
+		if (strlen(funcs[i].name) == len && !strncmp(funcs[i].name, name, len))
+			break;
+	if (i == sizeof(funcs) / sizeof(funcs[0]))
+		return fail(p, "unknown name '%.*s'", len, name);
+
+	if (expect(p, '(') || (a = parse_expr(p)) < 0)
+		return -1;
+	if (funcs[i].args == 2 && (expect(p, ',') || (b = parse_expr(p)) < 0))
+		return -1;
+	if (expect(p, ')'))
+		return -1;
+	return node(p, funcs[i].op, a, b, 0.0f);
+}
+
+static int parse_primary(struct parser *p)
+{
+	const char *name;
+	char *end;
+	float k;
+	int c = peek(p), i, len;
+
+	if (isdigit(c) || c == '.') {
+		k = strtof(p->p, &end);
+		if (end == p->p)
+			return fail(p, "bad number");
+		p->p = end;
+		return node(p, OP_CONST, 0, 0, k);
+	}
+
+	if (c == '(') {
+		p->p++;
+		if ((i = parse_expr(p)) < 0 || expect(p, ')'))
+			return -1;
+		return i;
+	}
+
+	if (!isalpha(c))
+		return fail(p, c ? "unexpected '%c'" : "unexpected end", c);
+
+	for (name = p->p; isalnum((unsigned char)*p->p); p->p++)
+		;
+	len = p->p - name;
+
+	if (len == 1 && *name == 'x')
+		return node(p, OP_X, 0, 0, 0.0f);
+	if (len == 1 && *name == 'y') {
+		p->flags |= EXPR_Y;
+		return node(p, OP_Y, 0, 0, 0.0f);
+	}
+	if (len == 1 && *name == 't') {
+		p->flags |= EXPR_TIME;
+		return node(p, OP_T, 0, 0, 0.0f);
+	}
+	if (len == 2 && !strncmp(name, "pi", 2))
+		return node(p, OP_CONST, 0, 0, M_PI);
+	if (len == 1 && *name == 'e')
+		return node(p, OP_CONST, 0, 0, M_E);
+	return parse_call(p, name, len);
+}
+
+/* right associative, and binds tighter than a unary minus: -x^2 is -(x^2) */
+static int parse_power(struct parser *p)
+{
+	int a = parse_primary(p);
+
+	if (a < 0 || peek(p) != '^')
+		return a;
+	p->p++;
+	return node(p, OP_POW, a, parse_unary(p), 0.0f);
+}
+
+static int parse_unary(struct parser *p)
+{
+	int c = peek(p);
+
+	if (c == '-') {
+		p->p++;
+		return node(p, OP_NEG, parse_unary(p), 0, 0.0f);
+	}
+	if (c == '+') {
+		p->p++;
+		return parse_unary(p);
+	}
+	return parse_power(p);
+}
+
+static int parse_term(struct parser *p)
+{
+	int a = parse_unary(p), c;
+
+	while (a >= 0 && ((c = peek(p)) == '*' || c == '/')) {
+		p->p++;
+		a = node(p, c == '*' ? OP_MUL : OP_DIV, a, parse_unary(p), 0.0f);
+	}
+	return a;
+}
+
+static int parse_expr(struct parser *p)
+{
+	int a = parse_term(p), c;
+
+	while (a >= 0 && ((c = peek(p)) == '+' || c == '-')) {
+		p->p++;
+		a = node(p, c == '+' ? OP_ADD : OP_SUB, a, parse_term(p), 0.0f);
+	}
+	return a;
+}
+
+/******************************************************************************/
+
+static void mark(struct parser *p, int i, char *live)
+{
+	if (live[i])
+		return;
+	live[i] = 1;
+	if (UNARY(p->n[i].op) || BINARY(p->n[i].op))
+		mark(p, p->n[i].a, live);
+	if (BINARY(p->n[i].op))
+		mark(p, p->n[i].b, live);
+}
+
+static struct insn *emit(struct expr *e, int op, int dst, int a, int b, float k)
+{
+	struct insn *c = &e->code[e->len++];
+
+	c->op = op;
+	c->dst = dst;
+	c->a = a;
+	c->b = b;
+	c->k = k;
+	return c;
+}
+
+/*
+ * The virtual register holding node i, loading constants on first use.
+ * Until allocation, a virtual register is simply the node's index.
+ */
+static int vreg(struct parser *p, struct expr *e, int i, char *loaded)
+{
+	if (p->n[i].op == OP_X)
+		return REG_X;
+	if (p->n[i].op == OP_Y)
+		return REG_Y;
+	if (p->n[i].op == OP_CONST && !loaded[i]) {
+		emit(e, OP_LOADK, i, 0, 0, p->n[i].k);
+		loaded[i] = 1;
+	}
+	return i;
+}
+
+static int kform(int op)
+{
+	switch (op) {
+	case OP_ADD: return OP_ADDK;
+	case OP_SUB: return OP_SUBK;
+	case OP_MUL: return OP_MULK;
+	case OP_DIV: return OP_DIVK;
+	case OP_POW: return OP_POWK;
+	case OP_MIN: return OP_MINK;
+	case OP_MAX: return OP_MAXK;
+	}
+	return -1;
+}
+
+static void generate(struct parser *p, struct expr *e, int root)
+{
+	char live[NODE_CNT] = { 0 }, loaded[NODE_CNT] = { 0 };
+	struct node *n;
+	int i, a;
+
+	mark(p, root, live);
+	for (i = 0; i < p->cnt; i++) {
+		n = &p->n[i];
+		if (!live[i])
+			continue;
+
+		if (n->op == OP_T) {
+			emit(e, OP_LOADT, i, 0, 0, 0.0f);
+		} else if (UNARY(n->op)) {
+			a = vreg(p, e, n->a, loaded);
+			emit(e, n->op, i, a, 0, 0.0f);
+		} else if (BINARY(n->op) && p->n[n->b].op == OP_CONST) {
+			a = vreg(p, e, n->a, loaded);
+			emit(e, kform(n->op), i, a, 0, p->n[n->b].k);
+		} else if (n->op == OP_SUB && p->n[n->a].op == OP_CONST) {
+			emit(e, OP_RSUBK, i, vreg(p, e, n->b, loaded), 0, p->n[n->a].k);
+		} else if (n->op == OP_DIV && p->n[n->a].op == OP_CONST) {
+			emit(e, OP_RDIVK, i, vreg(p, e, n->b, loaded), 0, p->n[n->a].k);
+		} else if (BINARY(n->op)) {
+			a = vreg(p, e, n->a, loaded);
+			emit(e, n->op, i, a, vreg(p, e, n->b, loaded), 0.0f);
+		}
+	}
+	e->out = vreg(p, e, root, loaded);
+}
+
+#define READS_A(op)	((op) != OP_LOADK && (op) != OP_LOADT)
+#define READS_B(op)	BINARY(op)
+
+/*
+ * Map virtual registers onto as few real ones as their lifetimes allow. An
+ * operand read for the last time frees its register before the result is
+ * given one, so most instructions end up working in place.
+ */
+static int allocate(struct expr *e)
+{
+	int last[NODE_CNT], map[NODE_CNT], free_regs[REG_CNT];
+	int i, a, b, nfree = 0;
+	struct insn *c;
+
+	for (i = 0; i < e->len; i++) {
+		c = &e->code[i];
+		last[c->dst] = i;
+		if (READS_A(c->op) && c->a >= 0)
+			last[c->a] = i;
+		if (READS_B(c->op) && c->b >= 0)
+			last[c->b] = i;
+	}
+	if (e->out >= 0)
+		last[e->out] = e->len;
+
+	e->regs = 0;
+	for (i = 0; i < e->len; i++) {
+		c = &e->code[i];
+		a = c->a;
+		b = c->b;
+		if (READS_A(c->op) && a >= 0) {
+			c->a = map[a];
+			if (last[a] == i)
+				free_regs[nfree++] = map[a];
+		}
+		if (READS_B(c->op) && b >= 0) {
+			c->b = map[b];
+			if (last[b] == i && b != a)
+				free_regs[nfree++] = map[b];
+		}
+
+		if (nfree) {
+			map[c->dst] = free_regs[--nfree];
+		} else {
+			if (e->regs == REG_CNT)
+				return -1;
+			map[c->dst] = e->regs++;
+		}
+		c->dst = map[c->dst];
+	}
+	if (e->out >= 0)
+		e->out = map[e->out];
+	return 0;
+}
+
+struct expr *expr_compile(const char *s, char *err, int err_sz)
+{
+	struct parser *p = calloc(1, sizeof(*p));
+	struct expr *e = calloc(1, sizeof(*e));
+	int root;
+
+	if (!p || !e) {
+		snprintf(err, err_sz, "out of memory");
+		goto fail;
+	}
+
+	p->s = p->p = s;
+	p->err = err;
+	p->err_sz = err_sz;
+	err[0] = '\0';
+
+	root = parse_expr(p);
+	if (root >= 0 && peek(p))
+		root = fail(p, "unexpected '%c'", *p->p);
+	if (root < 0)
+		goto fail;
+
+	generate(p, e, root);
+	if (allocate(e)) {
+		snprintf(err, err_sz, "expression too complex");
+		goto fail;
+	}
+
+	e->flags = p->flags;
+	free(p);
+	return e;
+
+fail:
+	free(p);
+	free(e);
+	return NULL;
+}
+
+void expr_free(struct expr *e)
+{
+	if (!e)
+		return;
+	free(e);
+}
+
+int expr_flags(struct expr *e)
+{
+	return e->flags;
+}
+
+/******************************************************************************/
+
+#define REG(r, x, y, i)	((i) == REG_X ? (float *)(x) : \
+			 (i) == REG_Y ? (float *)(y) : (r) + (i) * BLOCK)
+
+/* r is the caller's, so any number of threads can share e */
+static void run(struct expr *e, float *r, float *z, const float *x,
+		const float *y, float t, int n)
+{
+	struct insn *c;
+	float *d, *a, *b, k;
+	int i;
+
+	for (c = e->code; c < e->code + e->len; c++) {
+		d = REG(r, x, y, c->dst);
+		a = REG(r, x, y, c->a);
+		b = REG(r, x, y, c->b);
+		k = c->k;
+
+		switch (c->op) {
+		case OP_LOADK: for (i = 0; i < n; i++) d[i] = k; break;
+		case OP_LOADT: for (i = 0; i < n; i++) d[i] = t; break;
+
+		case OP_NEG:  vaxpb(d, a, -1.0f, 0.0f, n); break;
+		case OP_SIN:  vsin(d, a, n); break;
+		case OP_COS:  vcos(d, a, n); break;
+		case OP_TAN:  vtan(d, a, n); break;
+		case OP_EXP:  for (i = 0; i < n; i++) d[i] = expf(a[i]); break;
+		case OP_LOG:  for (i = 0; i < n; i++) d[i] = logf(a[i]); break;
+		case OP_SQRT: for (i = 0; i < n; i++) d[i] = sqrtf(a[i]); break;
+		case OP_ABS:  for (i = 0; i < n; i++) d[i] = fabsf(a[i]); break;
+
+		case OP_ADD: vadd(d, a, b, n); break;
+		case OP_SUB: for (i = 0; i < n; i++) d[i] = a[i] - b[i]; break;
+		case OP_MUL: vmul(d, a, b, n); break;
+		case OP_DIV: vdiv(d, a, b, n); break;
+		case OP_POW: for (i = 0; i < n; i++) d[i] = powf(a[i], b[i]); break;
+		case OP_MIN: for (i = 0; i < n; i++) d[i] = fminf(a[i], b[i]); break;
+		case OP_MAX: for (i = 0; i < n; i++) d[i] = fmaxf(a[i], b[i]); break;
+
+		case OP_ADDK:  vaxpb(d, a, 1.0f, k, n); break;
+		case OP_SUBK:  vaxpb(d, a, 1.0f, -k, n); break;
+		case OP_RSUBK: vaxpb(d, a, -1.0f, k, n); break;
+		case OP_MULK:  for (i = 0; i < n; i++) d[i] = a[i] * k; break;
+		case OP_DIVK:  for (i = 0; i < n; i++) d[i] = a[i] / k; break;
+		case OP_RDIVK: for (i = 0; i < n; i++) d[i] = k / a[i]; break;
+		case OP_POWK:  vpow(d, a, k, n); break;
+		case OP_MINK:  for (i = 0; i < n; i++) d[i] = fminf(a[i], k); break;
+		case OP_MAXK:  for (i = 0; i < n; i++) d[i] = fmaxf(a[i], k); break;
+		}
+	}
+	memcpy(z, REG(r, x, y, e->out), n * sizeof(*z));
+}
+
+void expr_eval_xy(struct expr *e, float *z, const float *x, const float *y,
+		  float t, int n)
+{
+	float r[MAX(e->regs, 1) * BLOCK];	/* 64k at most */
+	float none[BLOCK];
+	int i;
+
+	/* no y given, one read is NaN */
+	if (!y && (e->flags & EXPR_Y))
+		for (i = 0; i < BLOCK; i++)
+			none[i] = NAN;
+
+	for (i = 0; i < n; i += BLOCK)
+		run(e, r, z + i, x + i, y ? y + i : none, t, MIN(n - i, BLOCK));
+}
+
+void expr_eval(struct expr *e, float *y, const float *x, float t, int n)
+{
+	expr_eval_xy(e, y, x, NULL, t, n);
+}
+
+float expr_eval1(struct expr *e, float x, float t)
+{
+	float y;
+
+	expr_eval(e, &y, &x, t, 1);
+	return y;
+}
+
+/******************************************************************************/
+
+/*
+ * Interval evaluation: each register holds the range its values take for x
+ * anywhere in [x0, x1], and the range of their slope in x, carried through
+ * the code by the usual rules. A NaN end, from inf - inf or 0 * inf or a
+ * result undefined somewhere in range, widens to everything.
+ */
+
+struct iv {
+	double lo, hi;
+};
+
+struct dual {
+	struct iv v, d;		/* value, slope */
+};
+
+static const struct iv iv_all = { -INFINITY, INFINITY };
+
+static struct iv iv(double lo, double hi)
+{
+	struct iv r = { lo, hi };
+
+	return isnan(lo) || isnan(hi) ? iv_all : r;
+}
+
+static struct iv iv_add(struct iv a, struct iv b)
+{
+	return iv(a.lo + b.lo, a.hi + b.hi);
+}
+
+static struct iv iv_sub(struct iv a, struct iv b)
+{
+	return iv(a.lo - b.hi, a.hi - b.lo);
+}
+
+static struct iv iv_neg(struct iv a)
+{
+	return iv(-a.hi, -a.lo);
+}
+
+static struct iv iv_mul(struct iv a, struct iv b)
+{
+	double p0 = a.lo * b.lo, p1 = a.lo * b.hi;
+	double p2 = a.hi * b.lo, p3 = a.hi * b.hi;
+
+	if (isnan(p0) || isnan(p1) || isnan(p2) || isnan(p3))
+		return iv_all;
+	return iv(fmin(fmin(p0, p1), fmin(p2, p3)),
+		  fmax(fmax(p0, p1), fmax(p2, p3)));
+}
+
+/* a divisor that may be 0 is a pole, or 0 / 0 */
+static struct iv iv_div(struct iv a, struct iv b)
+{
+	if (b.lo <= 0.0 && b.hi >= 0.0)
+		return iv_all;
+	return iv_mul(a, iv(1.0 / b.hi, 1.0 / b.lo));
+}
+
+static struct iv iv_hull(struct iv a, struct iv b)
+{
+	return iv(fmin(a.lo, b.lo), fmax(a.hi, b.hi));
+}
+
+static struct iv iv_abs(struct iv a)
+{
+	if (a.lo >= 0.0)
+		return a;
+	if (a.hi <= 0.0)
+		return iv_neg(a);
+	return iv(0.0, fmax(-a.lo, a.hi));
+}
+
+/* the peaks at pi/2 + 2 k pi and troughs at -pi/2 + 2 k pi in range */
+static struct iv iv_sin(struct iv a)
+{
+	double lo = fmin(sin(a.lo), sin(a.hi)), hi = fmax(sin(a.lo), sin(a.hi));
+
+	if (!(a.hi - a.lo < 2.0 * M_PI))
+		return iv(-1.0, 1.0);
+	if (ceil((a.lo - M_PI_2) / (2.0 * M_PI)) * 2.0 * M_PI + M_PI_2 <= a.hi)
+		hi = 1.0;
+	if (ceil((a.lo + M_PI_2) / (2.0 * M_PI)) * 2.0 * M_PI - M_PI_2 <= a.hi)
+		lo = -1.0;
+	return iv(lo, hi);
+}
+
+static struct iv iv_cos(struct iv a)
+{
+	return iv_sin(iv(a.lo + M_PI_2, a.hi + M_PI_2));
+}
+
+/* rising between the poles at pi/2 + k pi */
+static struct iv iv_tan(struct iv a)
+{
+	if (!(a.hi - a.lo < M_PI) ||
+	    ceil((a.lo - M_PI_2) / M_PI) * M_PI + M_PI_2 <= a.hi)
+		return iv_all;
+	return iv(tan(a.lo), tan(a.hi));
+}
+
+/* the rest rise wherever they are defined */
+static struct iv iv_exp(struct iv a)
+{
+	return iv(exp(a.lo), exp(a.hi));
+}
+
+static struct iv iv_log(struct iv a)
+{
+	return a.lo > 0.0 ? iv(log(a.lo), log(a.hi)) : iv_all;
+}
+
+static struct iv iv_sqrt(struct iv a)
+{
+	return a.lo >= 0.0 ? iv(sqrt(a.lo), sqrt(a.hi)) : iv_all;
+}
+
+static struct iv iv_powi(struct iv a, int e)
+{
+	if (e < 0)
+		return iv_div(iv(1.0, 1.0), iv_powi(a, -e));
+	if (!(e & 1))
+		a = iv_abs(a);
+	return iv(pow(a.lo, e), pow(a.hi, e));
+}
+
+static struct iv iv_min(struct iv a, struct iv b)
+{
+	return iv(fmin(a.lo, b.lo), fmin(a.hi, b.hi));
+}
+
+static struct iv iv_max(struct iv a, struct iv b)
+{
+	return iv(fmax(a.lo, b.lo), fmax(a.hi, b.hi));
+}
+
+/******************************************************************************/
+
+/* the slope rules, a and b as they were before the op */
+
+static struct dual dual(struct iv v, struct iv d)
+{
+	struct dual r = { v, d };
+
+	return r;
+}
+
+static struct dual d_mul(struct dual a, struct dual b)
+{
+	struct dual r;
+
+	r.v = iv_mul(a.v, b.v);
+	r.d = iv_add(iv_mul(a.d, b.v), iv_mul(a.v, b.d));
+	return r;
+}
+
+/* (a / b)' = (a' - (a / b) b') / b */
+static struct dual d_div(struct dual a, struct dual b)
+{
+	struct dual r;
+
+	r.v = iv_div(a.v, b.v);
+	r.d = iv_div(iv_sub(a.d, iv_mul(r.v, b.d)), b.v);
+	return r;
+}
+
+/* a^b = exp(b log a), for a > 0 only */
+static struct dual d_pow(struct dual a, struct dual b)
+{
+	struct iv l = iv_log(a.v);
+	struct dual r;
+
+	if (a.v.lo <= 0.0) {
+		r.v = r.d = iv_all;
+		return r;
+	}
+	r.v = iv_exp(iv_mul(b.v, l));
+	r.d = iv_mul(r.v, iv_add(iv_mul(b.d, l),
+				 iv_div(iv_mul(b.v, a.d), a.v)));
+	return r;
+}
+
+static struct dual d_powi(struct dual a, int e)
+{
+	struct dual r;
+
+	if (!e)
+		return dual(iv(1.0, 1.0), iv(0.0, 0.0));
+
+	r.v = iv_powi(a.v, e);
+	r.d = iv_mul(iv_mul(iv(e, e), iv_powi(a.v, e - 1)), a.d);
+	return r;
+}
+
+/* either side's slope, unless that side is the min (max) all through */
+static struct dual d_minmax(struct dual a, struct dual b, int max)
+{
+	struct dual r;
+
+	r.v = max ? iv_max(a.v, b.v) : iv_min(a.v, b.v);
+	if (max ? a.v.lo >= b.v.hi : a.v.hi <= b.v.lo)
+		r.d = a.d;
+	else if (max ? b.v.lo >= a.v.hi : b.v.hi <= a.v.lo)
+		r.d = b.d;
+	else
+		r.d = iv_hull(a.d, b.d);
+	return r;
+}
+
+static struct dual d_unary(int op, struct dual a)
+{
+	struct iv v;
+
+	switch (op) {
+	case OP_NEG:
+		return dual(iv_neg(a.v), iv_neg(a.d));
+	case OP_SIN:
+		return dual(iv_sin(a.v), iv_mul(iv_cos(a.v), a.d));
+	case OP_COS:
+		return dual(iv_cos(a.v), iv_neg(iv_mul(iv_sin(a.v), a.d)));
+	case OP_TAN:
+		v = iv_tan(a.v);
+		return dual(v, iv_mul(iv_add(iv(1.0, 1.0), iv_powi(v, 2)), a.d));
+	case OP_EXP:
+		v = iv_exp(a.v);
+		return dual(v, iv_mul(v, a.d));
+	case OP_LOG:
+		return dual(iv_log(a.v), iv_div(a.d, a.v));
+	case OP_SQRT:
+		v = iv_sqrt(a.v);
+		return dual(v, iv_div(a.d, iv_mul(iv(2.0, 2.0), v)));
+	case OP_ABS:
+		if (a.v.lo >= 0.0)
+			return a;
+		if (a.v.hi <= 0.0)
+			return dual(iv_neg(a.v), iv_neg(a.d));
+		return dual(iv_abs(a.v), iv_hull(a.d, iv_neg(a.d)));
+	}
+	return dual(iv_all, iv_all);
+}
+
+static struct dual d_binary(int op, struct dual a, struct dual b)
+{
+	switch (op) {
+	case OP_ADD: return dual(iv_add(a.v, b.v), iv_add(a.d, b.d));
+	case OP_SUB: return dual(iv_sub(a.v, b.v), iv_sub(a.d, b.d));
+	case OP_MUL: return d_mul(a, b);
+	case OP_DIV: return d_div(a, b);
+	case OP_POW: return d_pow(a, b);
+	case OP_MIN: return d_minmax(a, b, 0);
+	case OP_MAX: return d_minmax(a, b, 1);
+	}
+	return dual(iv_all, iv_all);
+}
+
+void expr_range(struct expr *e, double x0, double x1, float t,
+		struct expr_range *r)
+{
+	struct dual reg[REG_CNT], x, y, a = { 0 }, b = { 0 }, k;
+	struct insn *c;
+
+	x = dual(iv(x0, x1), iv(1.0, 1.0));
+	y = dual(iv_all, iv_all);
+
+	for (c = e->code; c < e->code + e->len; c++) {
+		if (READS_A(c->op))
+			a = c->a == REG_X ? x : c->a == REG_Y ? y : reg[c->a];
+		if (READS_B(c->op))
+			b = c->b == REG_X ? x : c->b == REG_Y ? y : reg[c->b];
+		k = dual(iv(c->k, c->k), iv(0.0, 0.0));
+
+		switch (c->op) {
+		case OP_LOADK: a = k; break;
+		case OP_LOADT: a = dual(iv(t, t), iv(0.0, 0.0)); break;
+
+		case OP_ADDK:  a = d_binary(OP_ADD, a, k); break;
+		case OP_SUBK:  a = d_binary(OP_SUB, a, k); break;
+		case OP_RSUBK: a = d_binary(OP_SUB, k, a); break;
+		case OP_MULK:  a = d_binary(OP_MUL, a, k); break;
+		case OP_DIVK:  a = d_binary(OP_DIV, a, k); break;
+		case OP_RDIVK: a = d_binary(OP_DIV, k, a); break;
+		case OP_MINK:  a = d_binary(OP_MIN, a, k); break;
+		case OP_MAXK:  a = d_binary(OP_MAX, a, k); break;
+		case OP_POWK:
+			/* a whole power is defined for a of either sign */
+			if (fabsf(c->k) <= POWI_MAX && c->k == (int)c->k)
+				a = d_powi(a, c->k);
+			else
+				a = d_pow(a, k);
+			break;
+
+		default:
+			if (UNARY(c->op))
+				a = d_unary(c->op, a);
+			else
+				a = d_binary(c->op, a, b);
+			break;
+		}
+		reg[c->dst] = a;
+	}
+
+	a = e->out == REG_X ? x : e->out == REG_Y ? y : reg[e->out];
+	r->lo = a.v.lo;
+	r->hi = a.v.hi;
+	r->dlo = a.d.lo;
+	r->dhi = a.d.hi;
+}
+
+static void dump_reg(int r)
+{
+	if (r == REG_X)
+		printf(" x");
+	else if (r == REG_Y)
+		printf(" y");
+	else
+		printf(" r%d", r);
+}
+
+void expr_dump(struct expr *e)
+{
+	struct insn *c;
+
+	for (c = e->code; c < e->code + e->len; c++) {
+		printf("\tr%d = %s", c->dst, op_names[c->op]);
+		if (c->op != OP_LOADK && c->op != OP_LOADT)
+			dump_reg(c->a);
+		if (BINARY(c->op))
+			dump_reg(c->b);
+		if (c->op == OP_LOADK || c->op >= OP_ADDK)
+			printf(" %g", c->k);
+		printf("\n");
+	}
+	if (e->out < 0)
+		printf("\t=%s\n", e->out == REG_X ? " x" : " y");
+	else
+		printf("\t= r%d, %d registers\n", e->out, e->regs);
+}
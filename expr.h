@@ -0,0 +1,41 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+/*
+ * Expressions in x and t, e.g. "sin(1.4 * x) + 3.4" or "x^3 / (1 + t)",
+ * compiled to register bytecode and evaluated over float arrays. y is there
+ * too, for surfaces. Only expr_eval_xy() gives it a value, expr_eval() and
+ * expr_eval1() take it as NaN, and so does expr_eval_xy() with y NULL.
+ *
+ *   + - * / ^ (right associative), unary -, parentheses, numbers, pi, e
+ *   sin cos tan exp log sqrt abs, pow(a, b) min(a, b) max(a, b)
+ */
+
+struct expr;
+
+#define EXPR_TIME	(1 << 0)	/* refers to t */
+#define EXPR_Y		(1 << 1)	/* refers to y */
+
+struct expr *expr_compile(const char *s, char *err, int err_sz);
+void         expr_free   (struct expr *e);
+int          expr_flags  (struct expr *e);
+
+void  expr_eval (struct expr *e, float *y, const float *x, float t, int n);
+float expr_eval1(struct expr *e, float x, float t);
+void  expr_eval_xy(struct expr *e, float *z, const float *x, const float *y,
+		   float t, int n);
+
+/*
+ * Every value of f and of its slope for x0 <= x <= x1, loose but never too
+ * narrow short of rounding. Ends are infinite where there is no telling,
+ * anywhere f may be undefined or unbounded in there for one. A finite
+ * slope range means f is continuous there, one not spanning 0 monotone.
+ */
+struct expr_range {
+	double lo, hi;
+	double dlo, dhi;
+};
+
+void expr_range(struct expr *e, double x0, double x1, float t,
+		struct expr_range *r);
+
+void expr_dump(struct expr *e);
@@ -1,14 +1,24 @@
 /* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
 
 #include <ctype.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <pthread.h>
 #include <time.h>
 
+#include "approx.h"
 #include "dbx.h"
+#include "density.h"
+#include "expr.h"
+#include "heat.h"
+#include "live.h"
+#include "pool.h"
+#include "series.h"
+#include "vmath.h"
 
 int _random(int min, int max)
 {
@@ -25,6 +35,10 @@ int _random(int min, int max)
 float accum;
 int paused = 1;
 u32 prev_time;
+
+/* uptime() as of this frame, what the functions see from any thread */
+float now;
+
 float uptime(void)
 {
 	u32 m, ms = tickcount_ms();
@@ -191,7 +205,7 @@ float func2(float x) { return 2 * cos(x + 0.3); }
 
 float func3(float x)
 {
-	float t = uptime();
+	float t = now;
 
 	if (t < 5.0f || t > 7.0f)
 		return NAN;
@@ -201,7 +215,7 @@ float func3(float x)
 #endif
 float func4(float x)
 {
-	float t = uptime();
+	float t = now;
 
 	if (t < 1.0f || t > 7.0f)
 		return NAN;
@@ -221,89 +235,1335 @@ float func8(float x)
 	return sin(x);
 }
 
-float factorial(int x)
+/* the series in Horner form over a table of 1 / n!, see approx.h */
+float func8_a(float x) { return approx_taylor_sin(x, 1); }
+float func8_b(float x) { return approx_taylor_sin(x, 2); }
+float func8_c(float x) { return approx_taylor_sin(x, 5); }
+float func8_d(float x) { return approx_taylor_sin(x, 30); }
+
+float syncx(float x)
 {
-	float v;
+	return sin(x) / x;
+}
+
+/******************************************************************************/
 
-	for (v = 1; x; x--)
-		v *= x;
-	return v;
+/*
+ * Batch versions, y[i] = f(x[i]) over a whole column array. They run on
+ * the pool's threads, intermediates go in the thread's own scratch().
+ */
+
+__thread float *tmp;
+__thread int tmp_cnt;
+
+float *scratch(int n)
+{
+	if (n > tmp_cnt) {
+		free(tmp);
+		tmp = malloc(n * sizeof(*tmp));
+		tmp_cnt = tmp ? n : 0;
+		if (!tmp)
+			printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+	}
+	return tmp;
 }
 
-float taylor_sin(float x, int terms)
+void nan_fill(float *y, int n)
 {
-	int i, sign = -1, exp = 3;
-	float y = x;
+	int i;
 
-	for (i = 0; i < terms; i++, sign *= -1, exp += 2)
-		y += sign * (pow(x, exp) / factorial(exp));
-	return y;
+	for (i = 0; i < n; i++)
+		y[i] = NAN;
 }
 
-float func8_a(float x) { return taylor_sin(x, 1); }
-float func8_b(float x) { return taylor_sin(x, 2); }
-float func8_c(float x) { return taylor_sin(x, 5); }
-float func8_d(float x) { return taylor_sin(x, 30); }
+void func1_v(float *y, const float *x, int n)
+{
+	vsin(y, x, n);
+	vaxpb(y, y, 1.0f, 5.8f, n);
+}
 
-float syncx(float x)
+void func2_v(float *y, const float *x, int n)
 {
-	return sin(x) / x;
+	vaxpb(y, x, 1.4f, 0.0f, n);
+	vsin(y, y, n);
+	vaxpb(y, y, 1.0f, 3.4f, n);
+}
+
+void func3_v(float *y, const float *x, int n)
+{
+	float *tmp = scratch(n);
+
+	if (!tmp) {
+		nan_fill(y, n);
+		return;
+	}
+
+	vaxpb(tmp, x, 1.4f, 0.0f, n);
+	vsin(tmp, tmp, n);
+	vsin(y, x, n);
+	vadd(y, y, tmp, n);
+}
+
+void func4_v(float *y, const float *x, int n)
+{
+	float t = now;
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (t < 1.0f || t > 7.0f || fabsf(x[i] - t) > 0.03f)
+			y[i] = NAN;
+		else
+			y[i] = -(x[i] - 4.0f) * (x[i] - 4.0f) + 9.0f;
+}
+
+void func5_v(float *y, const float *x, int n)
+{
+	vaxpb(y, x, 0.4f, 0.0f, n);
+	vtan(y, y, n);
+}
+
+void func6_v(float *y, const float *x, int n)
+{
+	vaxpb(y, x, 0.5f, 0.0f, n);
+	vpow(y, y, 3, n);
+}
+
+void func7_v(float *y, const float *x, int n) { vrcp(y, x, n); }
+void func8_v(float *y, const float *x, int n) { vsin(y, x, n); }
+
+/*
+ * approx_taylor_sin() a whole array at a time: Horner over the coefficients
+ * outside, the elements inside, in the vmath kernels
+ */
+void taylor_sin_v(float *y, const float *x, int n, int terms)
+{
+	float *z = scratch(n);
+
+	if (!z) {
+		nan_fill(y, n);
+		return;
+	}
+
+	terms = MIN(terms, APPROX_TAYLOR - 1);
+	if (!terms) {
+		memcpy(y, x, n * sizeof(*y));
+		return;
+	}
+
+	vmul(z, x, x, n);
+	terms--;
+	vaxpb(y, z, approx_sin_taylor[terms + 1], approx_sin_taylor[terms], n);
+	while (terms--) {
+		vmul(y, y, z, n);
+		vaxpb(y, y, 1.0f, approx_sin_taylor[terms], n);
+	}
+	vmul(y, y, x, n);
+}
+
+void func8_a_v(float *y, const float *x, int n) { taylor_sin_v(y, x, n, 1); }
+void func8_b_v(float *y, const float *x, int n) { taylor_sin_v(y, x, n, 2); }
+void func8_c_v(float *y, const float *x, int n) { taylor_sin_v(y, x, n, 5); }
+void func8_d_v(float *y, const float *x, int n) { taylor_sin_v(y, x, n, 30); }
+
+void syncx_v(float *y, const float *x, int n)
+{
+	vsin(y, x, n);
+	vdiv(y, y, x, n);
 }
 
 /******************************************************************************/
 
+/*
+ * Samples are cached per function on a grid of power of two spacing, at
+ * most a pixel wide and anchored at x = 0. Every column takes the sample
+ * nearest its left edge, so panning shifts whole samples along and zooming
+ * past an octave still finds every other one on the new grid.
+ */
+
+#define FUNC_TIME	(1 << 0)	/* reads now, never cached */
+
+struct cache {
+	double step;
+	long k0;
+	int cnt;
+	int cap;
+	float *y;
+	u8 *ok;
+};
+
+/*
+ * Per function sampling state: intervals iv[2 * i] to iv[2 * i + 1] being
+ * sampled and their midpoints m, the x of the samples left to evaluate, their
+ * cache index and y once evaluated
+ */
+struct sampler {
+	int *iv, *iv_next, *m;
+	int cnt;
+	int *i;
+	float *x, *y;
+	int n;
+	int cap;
+};
+
+/*
+ * Either compiled in, with batch optional and func called per sample
+ * without it, or given on the command line and compiled to expr, or
+ * recorded samples from a file in series rather than a function at all,
+ * or samples streamed in by live and appended to series as they arrive.
+ * A compiled in one can give its form as an expression as well, bound is
+ * that or expr, for expr_range() to tell where f can be.
+ */
+
+/* what a function's view cost, its samples as the job takes them */
+struct prof {
+	u64 us;			/* evaluating, over all threads */
+	long samples;
+	long nan, out;		/* undefined, off the screen */
+	long segs;		/* lines drawn, the last frame */
+};
+
 struct func {
 	u32 clr;
 	float (*func)(float);
-} funcs[] = {
-	{0x00e0e0, syncx },
+	void (*batch)(float *y, const float *x, int n);
+	int flags;
+	const char *name;	/* as given, an expression or file */
+	const char *form;
+	struct expr *bound;
+	struct expr *expr;
+	struct series *series;
+	struct live *live;
+	struct cache cache, next, spare;
+	int ready;		/* columns up to here sampled into next */
+	struct sampler s;
+	struct prof prof;
+} builtin[] = {
+	{0x00e0e0, syncx, syncx_v, .form = "sin(x) / x" },
 #if 0
-	//{ 0x909090, func8 },
-	{ 0xf06060, func8_a },
-	{ 0x60f060, func8_b },
-	{ 0x6060f0, func8_c },
-	{ 0xe0e0e0, func8_d },
+	//{ 0x909090, func8, func8_v, .form = "sin(x)" },
+	{ 0xf06060, func8_a, func8_a_v },
+	{ 0x60f060, func8_b, func8_b_v },
+	{ 0x6060f0, func8_c, func8_c_v },
+	{ 0xe0e0e0, func8_d, func8_d_v },
 #endif
 #if 0
-	{ 0xf0f000, func1 },
-	{ 0x00f0f0, func2 },
-	{ 0xf000f0, func3 },
+	{ 0xf0f000, func1, func1_v, .form = "sin(x) + 5.8" },
+	{ 0x00f0f0, func2, func2_v, .form = "sin(1.4 * x) + 3.4" },
+	{ 0xf000f0, func3, func3_v, .form = "sin(x) + sin(1.4 * x)" },
 #endif
 #if 0
-	{ 0x30e080, func4 },
-	{ 0xe05060, func5 },
-	{ 0x80e080, func6 },
-	{ 0xa0f0a0, func7 },
+	{ 0x30e080, func4, func4_v, FUNC_TIME },
+	{ 0xe05060, func5, func5_v, .form = "tan(0.4 * x)" },
+	{ 0x80e080, func6, func6_v, .form = "(0.5 * x)^3" },
+	{ 0xa0f0a0, func7, func7_v, .form = "1 / x" },
 #endif
 };
 
+struct func *funcs = builtin;
+int func_cnt = ARRAY_SIZE(builtin);
+
+void func_eval(struct func *f, float *y, const float *x, int n)
+{
+	int i;
+
+	if (f->expr)
+		expr_eval(f->expr, y, x, now, n);
+	else if (f->batch)
+		f->batch(y, x, n);
+	else
+		for (i = 0; i < n; i++)
+			y[i] = f->func(x[i]);
+}
+
+float func_eval1(struct func *f, float x)
+{
+	return f->expr ? expr_eval1(f->expr, x, now) : f->func(x);
+}
+
+/* screen y = sy_a * f(x) + sy_b, and f off the screen below lo, above hi */
+float sy_a, sy_b;
+float view_lo, view_hi;
+
+/* per column: its sample past the first, a data series' samples in it */
+int *col_k;
+struct m4 *m4;
+int col_cnt;
+
+int sampler_init(struct sampler *s, int n)
+{
+	if (n <= s->cap)
+		return 0;
+
+	free(s->iv);
+	free(s->iv_next);
+	free(s->m);
+	free(s->i);
+	free(s->x);
+	free(s->y);
+	s->iv = malloc(n * sizeof(*s->iv));
+	s->iv_next = malloc(n * sizeof(*s->iv_next));
+	s->m = malloc(n * sizeof(*s->m));
+	s->i = malloc(n * sizeof(*s->i));
+	s->x = malloc(n * sizeof(*s->x));
+	s->y = malloc(n * sizeof(*s->y));
+	if (!s->iv || !s->iv_next || !s->m || !s->i || !s->x || !s->y) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		s->cap = 0;
+		return -1;
+	}
+	s->cap = n;
+	return 0;
+}
+
+int columns(int n)
+{
+	int i;
+
+	if (n > col_cnt) {
+		free(col_k);
+		free(m4);
+		col_k = malloc(n * sizeof(*col_k));
+		m4 = malloc(n * sizeof(*m4));
+		if (!col_k || !m4) {
+			printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+			col_cnt = 0;
+			return -1;
+		}
+		col_cnt = n;
+	}
+
+	for (i = 0; i < func_cnt; i++)
+		if (!funcs[i].series && sampler_init(&funcs[i].s, n))
+			return -1;
+	return 0;
+}
+
+int cache_init(struct cache *c, double step, long k0, int cnt)
+{
+	if (cnt > c->cap) {
+		free(c->y);
+		free(c->ok);
+		c->y = malloc(cnt * sizeof(*c->y));
+		c->ok = malloc(cnt * sizeof(*c->ok));
+		c->cap = c->y && c->ok ? cnt : 0;
+		if (!c->cap) {
+			printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+			c->cnt = 0;
+			return -1;
+		}
+	}
+	c->step = step;
+	c->k0 = k0;
+	c->cnt = cnt;
+	memset(c->ok, 0, cnt);
+	return 0;
+}
+
+/* carry over what old has of c's samples */
+void cache_reuse(struct cache *c, struct cache *old)
+{
+	long k, j;
+	int i;
+
+	if (!old->cnt)
+		return;
+
+	for (i = 0; i < c->cnt; i++) {
+		k = c->k0 + i;
+		if (old->step == c->step)
+			j = k;
+		else if (old->step == c->step * 2 && !(k & 1))
+			j = k / 2;
+		else if (old->step == c->step / 2)
+			j = k * 2;
+		else
+			continue;
+
+		j -= old->k0;
+		if (j >= 0 && j < old->cnt && old->ok[j]) {
+			c->y[i] = old->y[j];
+			c->ok[i] = 1;
+		}
+	}
+}
+
+/*
+ * queue the samples for columns s->m[0..cnt) that f->next is missing, no
+ * two columns share one
+ */
+void gather(struct func *f, int cnt)
+{
+	struct sampler *s = &f->s;
+	struct cache *c = &f->next;
+	int x, i;
+
+	for (x = 0, s->n = 0; x < cnt; x++) {
+		i = col_k[s->m[x]];
+		if (c->ok[i])
+			continue;
+		s->i[s->n] = i;
+		s->x[s->n++] = (c->k0 + i) * c->step;
+	}
+}
+
+/*
+ * Everything gather() queued, for all functions at once, cut in chunks so
+ * one expensive function still spreads over all the threads.
+ */
+
+#define CHUNK_MIN	16
+#define CHUNKS		4	/* per thread, to even out the load */
+
+struct pool *pool;
+
+/* a thread's own, the background evaluation has one too */
+struct task {
+	struct func *f;
+	int off, n;
+};
+__thread struct task *tasks;
+__thread int task_cap;
+
+int cancelled(void);
+
+int task_reserve(int cnt)
+{
+	struct task *t;
+
+	if (cnt <= task_cap)
+		return 0;
+
+	t = realloc(tasks, cnt * sizeof(*t));
+	if (!t) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		return -1;
+	}
+	tasks = t;
+	task_cap = cnt;
+	return 0;
+}
+
+void eval_task(void *arg, int i)
+{
+	struct task *t = (struct task *)arg + i;
+	struct sampler *s = &t->f->s;
+	struct prof *p = &t->f->prof;
+	float *y = s->y + t->off;
+	long nan = 0, out = 0;
+	u64 start;
+	int j;
+
+	if (cancelled())
+		return;
+
+	start = tickcount_us();
+	func_eval(t->f, y, s->x + t->off, t->n);
+	__atomic_add_fetch(&p->us, tickcount_us() - start, __ATOMIC_RELAXED);
+
+	for (j = 0; j < t->n; j++) {
+		nan += isnan(y[j]);
+		out += y[j] < view_lo || y[j] > view_hi;
+	}
+	__atomic_add_fetch(&p->samples, t->n, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&p->nan, nan, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&p->out, out, __ATOMIC_RELAXED);
+}
+
+void evaluate(void)
+{
+	int i, j, n, off, chunk, cnt;
+	struct sampler *s;
+	struct task *t;
+
+	for (i = 0, n = 0; i < func_cnt; i++)
+		n += funcs[i].s.n;
+	if (!n)
+		return;
+
+	/* a multiple of 8 keeps the vector kernels off their scalar tails */
+	chunk = MAX(n / (pool_threads(pool) * CHUNKS), CHUNK_MIN);
+	chunk = (chunk + 7) & ~7;
+
+	if (task_reserve(n / chunk + func_cnt))
+		return;
+
+	for (i = 0, cnt = 0; i < func_cnt; i++)
+		for (off = 0; off < funcs[i].s.n; off += chunk) {
+			t = &tasks[cnt++];
+			t->f = &funcs[i];
+			t->off = off;
+			t->n = MIN(funcs[i].s.n - off, chunk);
+		}
+	pool_run(pool, eval_task, tasks, cnt);
+
+	/* a cancelled job's next is kept for what it has, so only real ones */
+	if (cancelled())
+		return;
+	for (i = 0; i < func_cnt; i++) {
+		s = &funcs[i].s;
+		for (j = 0; j < s->n; j++) {
+			funcs[i].next.y[s->i[j]] = s->y[j];
+			funcs[i].next.ok[s->i[j]] = 1;
+		}
+	}
+}
+
+/******************************************************************************/
+
+/*
+ * Adaptive sampling: every COARSE columns first, then breadth first halving
+ * of the intervals whose midpoint is off the chord by more than TOL_PX, one
+ * batch per level. Flat stretches stay at the coarse spacing, the columns
+ * they skip are never evaluated.
+ */
+
+#define COARSE		8
+#define TOL_PX		0.5f
+#define JUMP_PX		8.0f	/* steps taller than this get bisected */
+#define BISECT		12
+
+#define CULL_PX		1.0f	/* rounding room for expr_range() */
+
+float screen_y(struct cache *c, int x)
+{
+	return sy_a * c->y[col_k[x]] + sy_b;
+}
+
+int bend(struct cache *c, int a, int m, int b)
+{
+	float ya = screen_y(c, a), ym = screen_y(c, m), yb = screen_y(c, b);
+
+	/* the curve may start or stop in there */
+	if (!isfinite(ya) || !isfinite(ym) || !isfinite(yb))
+		return 1;
+
+	return fabsf(ym - (ya * (b - m) + yb * (m - a)) / (b - a)) > TOL_PX;
+}
+
+/*
+ * f proven to stay above or below the screen from column a to b, so every
+ * line drawn between samples in there is off it too. A wildly oscillating
+ * f bends everywhere, this keeps the parts out of view from being split
+ * down to single columns. Not worth trying unless the samples at a, m and
+ * b are off the same side.
+ */
+int hidden(struct func *f, struct cache *c, int a, int m, int b)
+{
+	float ya = c->y[col_k[a]], ym = c->y[col_k[m]], yb = c->y[col_k[b]];
+	struct expr_range r;
+
+	if (!f->bound)
+		return 0;
+	if (!(ya > view_hi && ym > view_hi && yb > view_hi) &&
+	    !(ya < view_lo && ym < view_lo && yb < view_lo))
+		return 0;
+
+	expr_range(f->bound, (c->k0 + col_k[a]) * c->step,
+		   (c->k0 + col_k[b]) * c->step, now, &r);
+	return r.hi < view_lo || r.lo > view_hi;
+}
+
+/* split the intervals whose midpoint is off, and that can be seen */
+void refine(struct func *f)
+{
+	struct sampler *s = &f->s;
+	struct cache *c = &f->next;
+	int i, n, *t;
+
+	for (i = 0, n = 0; i < s->cnt; i++) {
+		if (!bend(c, s->iv[2 * i], s->m[i], s->iv[2 * i + 1]) ||
+		    hidden(f, c, s->iv[2 * i], s->m[i], s->iv[2 * i + 1]))
+			continue;
+		if (s->m[i] - s->iv[2 * i] > 1) {
+			s->iv_next[2 * n] = s->iv[2 * i];
+			s->iv_next[2 * n++ + 1] = s->m[i];
+		}
+		if (s->iv[2 * i + 1] - s->m[i] > 1) {
+			s->iv_next[2 * n] = s->m[i];
+			s->iv_next[2 * n++ + 1] = s->iv[2 * i + 1];
+		}
+	}
+	t = s->iv;
+	s->iv = s->iv_next;
+	s->iv_next = t;
+	s->cnt = n;
+}
+
+/*
+ * Columns c0 to c1, c1 included. All functions go down the levels together,
+ * one evaluate() per level.
+ */
+void sample(int c0, int c1)
+{
+	struct sampler *s;
+	int i, j, n, more;
+
+	for (i = 0; i < func_cnt; i++) {
+		s = &funcs[i].s;
+		if (funcs[i].series)
+			continue;
+		for (j = c0, n = 0; j < c1; j += COARSE)
+			s->m[n++] = j;
+		s->m[n++] = c1;
+		gather(&funcs[i], n);
+
+		for (j = 0, s->cnt = 0; j < n - 1; j++)
+			if (s->m[j + 1] - s->m[j] > 1) {
+				s->iv[2 * s->cnt] = s->m[j];
+				s->iv[2 * s->cnt++ + 1] = s->m[j + 1];
+			}
+	}
+	evaluate();
+
+	/* intervals are at least 2 wide, so 2 * cnt never exceeds wd */
+	while (!cancelled()) {
+		for (i = 0, more = 0; i < func_cnt; i++) {
+			s = &funcs[i].s;
+			for (j = 0; j < s->cnt; j++)
+				s->m[j] = (s->iv[2 * j] + s->iv[2 * j + 1]) / 2;
+			gather(&funcs[i], s->cnt);
+			more |= s->cnt;
+		}
+		if (!more)
+			break;
+
+		evaluate();
+		for (i = 0; i < func_cnt; i++)
+			refine(&funcs[i]);
+	}
+}
+
+/******************************************************************************/
+
+/*
+ * Sampling runs on a thread of its own, a block of columns at a time, each
+ * function's ready moved past a block once it is done. graph() waits for it
+ * what is left of FRAME_BUDGET_MS after any heatmap, then draws the blocks
+ * that are there and a bar for how far along it is, and looks again the
+ * next frame, so a slow function no longer holds up input. A new view
+ * cancels what is left of the last: the samples it got are kept for the
+ * new one, along with the last view finished.
+ */
+
+#define EVAL_COLS	256	/* to a block, a multiple of COARSE */
+#define FRAME_BUDGET_MS	20	/* of the UPDATE_PERIOD_MS frame */
+#define PROGRESS_CLR	0x80e080
+
+enum { EVAL_IDLE, EVAL_QUEUED, EVAL_RUNNING, EVAL_DONE, EVAL_CANCELLED };
+
+/* what the samples depend on */
+struct view {
+	struct state state;
+	int wd, ht;
+	float t;		/* 0 unless some function reads it */
+};
+
+struct eval {
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	pthread_t tid;
+	int started;
+	int quit;
+
+	int state;		/* done and cancelled stay so until restarted */
+	int cancel;
+	int wd;
+	struct view view;	/* last started */
+} eval = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.start = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+int eval_busy;			/* graph() to look again next frame */
+
+int cancelled(void)
+{
+	return __atomic_load_n(&eval.cancel, __ATOMIC_RELAXED);
+}
+
+void eval_run(int wd)
+{
+	int i, c0 = 0, c1;
+
+	do {
+		c1 = MIN(c0 + EVAL_COLS, wd - 1);
+		sample(c0, c1);
+		if (cancelled())
+			return;
+		for (i = 0; i < func_cnt; i++)
+			__atomic_store_n(&funcs[i].ready, c1, __ATOMIC_RELEASE);
+		c0 = c1;
+	} while (c1 < wd - 1);
+}
+
+void *eval_thread(void *arg)
+{
+	pthread_mutex_lock(&eval.lock);
+	for (;;) {
+		while (!eval.quit && eval.state != EVAL_QUEUED)
+			pthread_cond_wait(&eval.start, &eval.lock);
+		if (eval.quit)
+			break;
+		eval.state = EVAL_RUNNING;
+		pthread_mutex_unlock(&eval.lock);
+
+		eval_run(eval.wd);
+
+		pthread_mutex_lock(&eval.lock);
+		eval.state = cancelled() ? EVAL_CANCELLED : EVAL_DONE;
+		pthread_cond_broadcast(&eval.done);
+	}
+	pthread_mutex_unlock(&eval.lock);
+	free(tasks);
+	free(tmp);
+	return NULL;
+}
+
+/* back from the job, cancelled if it wasn't done */
+void eval_cancel(void)
+{
+	pthread_mutex_lock(&eval.lock);
+	if (eval.state == EVAL_QUEUED || eval.state == EVAL_RUNNING)
+		__atomic_store_n(&eval.cancel, 1, __ATOMIC_RELAXED);
+	while (eval.state == EVAL_QUEUED || eval.state == EVAL_RUNNING)
+		pthread_cond_wait(&eval.done, &eval.lock);
+	pthread_mutex_unlock(&eval.lock);
+}
+
+/* next set up afresh, with what the last finished and unfinished views had */
+int eval_start(int wd, double step, long k0)
+{
+	int i, cnt = 0;
+	struct cache c;
+	struct func *f;
+
+	for (i = 0; i < func_cnt; i++) {
+		f = &funcs[i];
+		if (f->series)
+			continue;
+		if (cache_init(&f->spare, step, k0, col_k[wd - 1] + 1))
+			return -1;
+		if (!(f->flags & FUNC_TIME)) {
+			cache_reuse(&f->spare, &f->cache);
+			cache_reuse(&f->spare, &f->next);
+		}
+		c = f->next;
+		f->next = f->spare;
+		f->spare = c;
+		f->ready = -1;
+		f->prof.us = f->prof.samples = f->prof.nan = f->prof.out = 0;
+		cnt++;
+	}
+
+	if (!cnt) {
+		pthread_mutex_lock(&eval.lock);
+		eval.state = EVAL_IDLE;
+		pthread_mutex_unlock(&eval.lock);
+		return 0;
+	}
+
+	if (!eval.started) {
+		if (pthread_create(&eval.tid, NULL, eval_thread, NULL)) {
+			printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+			return -1;
+		}
+		eval.started = 1;
+	}
+
+	pthread_mutex_lock(&eval.lock);
+	eval.cancel = 0;
+	eval.wd = wd;
+	eval.state = EVAL_QUEUED;
+	pthread_cond_signal(&eval.start);
+	pthread_mutex_unlock(&eval.lock);
+	return 0;
+}
+
+/* up to us for the job to finish, its state then, done handed over once */
+int eval_wait(long us)
+{
+	struct timespec ts;
+	int state;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += us * 1000L;
+	ts.tv_sec += ts.tv_nsec / 1000000000L;
+	ts.tv_nsec %= 1000000000L;
+
+	pthread_mutex_lock(&eval.lock);
+	while (eval.state == EVAL_QUEUED || eval.state == EVAL_RUNNING)
+		if (pthread_cond_timedwait(&eval.done, &eval.lock, &ts))
+			break;
+	state = eval.state;
+	if (state == EVAL_DONE)
+		eval.state = EVAL_IDLE;
+	pthread_mutex_unlock(&eval.lock);
+	return state;
+}
+
+void eval_stop(void)
+{
+	if (!eval.started)
+		return;
+
+	eval_cancel();
+	pthread_mutex_lock(&eval.lock);
+	eval.quit = 1;
+	pthread_cond_signal(&eval.start);
+	pthread_mutex_unlock(&eval.lock);
+	pthread_join(eval.tid, NULL);
+}
+
+/*
+ * A continuous function's step shrinks with the interval, a jump or a pole
+ * stays put however far it is narrowed down. A slope bounded all through,
+ * as anything monotone and defined there has, rules a jump out up front.
+ */
+int jump(struct func *f, float x1, float y1, float x2, float y2)
+{
+	float d = fabsf(y2 - y1), xm, ym;
+	struct expr_range r;
+	int i;
+
+	if (f->bound) {
+		expr_range(f->bound, x1, x2, now, &r);
+		if (isfinite(r.dlo) && isfinite(r.dhi))
+			return 0;
+	}
+
+	for (i = 0; i < BISECT; i++) {
+		xm = (x1 + x2) / 2;
+		ym = sy_a * func_eval1(f, xm) + sy_b;
+		if (!isfinite(ym))
+			return 1;
+		if (fabsf(ym - y1) > fabsf(y2 - ym)) {
+			x2 = xm;
+			y2 = ym;
+		} else {
+			x1 = xm;
+			y1 = ym;
+		}
+	}
+	return fabsf(y2 - y1) > d / 4;
+}
+
+/******************************************************************************/
+
+/*
+ * Polyline output: a run of vertices becomes one segment while every vertex
+ * stays within half a pixel of it, tracked as the range of slopes from the
+ * run's first vertex that still pass all of them.
+ */
+
+struct poly {
+	int n;
+	float x0, y0, x, y;
+	float lo, hi;
+} poly;
+
+/* clip a1..a2 to 0..max and b along with it, 0 if none of it is left */
+int clip(float *a1, float *b1, float *a2, float *b2, float max)
+{
+	if ((*a1 < 0 && *a2 < 0) || (*a1 > max && *a2 > max))
+		return 0;
+	if (*a1 < 0 || *a1 > max) {
+		*b1 += (*b2 - *b1) * (((*a1 < 0 ? 0 : max) - *a1) / (*a2 - *a1));
+		*a1 = *a1 < 0 ? 0 : max;
+	}
+	if (*a2 < 0 || *a2 > max) {
+		*b2 += (*b1 - *b2) * (((*a2 < 0 ? 0 : max) - *a2) / (*a1 - *a2));
+		*a2 = *a2 < 0 ? 0 : max;
+	}
+	return 1;
+}
+
+long segs;			/* drawn, for the function being plotted */
+
+void segment(struct dbx *d, float x1, float y1, float x2, float y2, u32 clr)
+{
+	/* a pole can put y anywhere, a data series' neighbours x too */
+	if (!clip(&y1, &x1, &y2, &x2, dbx_height(d)) ||
+	    !clip(&x1, &y1, &x2, &y2, dbx_width(d)))
+		return;
+	segs++;
+	dbx_draw_line(d, lroundf(x1), lroundf(y1), lroundf(x2), lroundf(y2), clr);
+}
+
+void poly_end(struct dbx *d, u32 clr)
+{
+	if (poly.n == 1 && poly.y >= 0 && poly.y <= dbx_height(d)) {
+		dbx_draw_point(d, poly.x, lroundf(poly.y), clr);
+		segs++;
+	} else if (poly.n > 1)
+		segment(d, poly.x0, poly.y0, poly.x, poly.y, clr);
+	poly.n = 0;
+}
+
+void poly_add(struct dbx *d, float x, float y, u32 clr)
+{
+	float dx, s;
+
+	if (!poly.n) {
+		poly.x0 = poly.x = x;
+		poly.y0 = poly.y = y;
+		poly.n = 1;
+		return;
+	}
+
+	dx = x - poly.x0;
+	s = (y - poly.y0) / dx;
+	if (poly.n > 1 && (s < poly.lo || s > poly.hi)) {
+		segment(d, poly.x0, poly.y0, poly.x, poly.y, clr);
+		poly.x0 = poly.x;
+		poly.y0 = poly.y;
+		poly.n = 1;
+		dx = x - poly.x0;
+	}
+	if (poly.n == 1) {
+		poly.lo = -INFINITY;
+		poly.hi = INFINITY;
+	}
+	poly.lo = fmaxf(poly.lo, (y - TOL_PX - poly.y0) / dx);
+	poly.hi = fminf(poly.hi, (y + TOL_PX - poly.y0) / dx);
+	poly.x = x;
+	poly.y = y;
+	poly.n++;
+}
+
+/* through every sample taken, broken where f is undefined or jumps */
+void plot(struct dbx *d, struct func *f, struct cache *c, int wd)
+{
+	float y, py = 0;
+	int x, px = -1;
+
+	for (x = 0; x < wd; x++) {
+		if (!c->ok[col_k[x]])
+			continue;
+
+		/* an infinity is a pole sampled right on */
+		y = screen_y(c, x);
+		if (!isfinite(y)) {
+			poly_end(d, f->clr);
+			px = -1;
+			continue;
+		}
+		if (px >= 0 && fabsf(y - py) > JUMP_PX &&
+		    jump(f, (c->k0 + col_k[px]) * c->step, py,
+			 (c->k0 + col_k[x]) * c->step, y))
+			poly_end(d, f->clr);
+
+		poly_add(d, x, y, f->clr);
+		px = x;
+		py = y;
+	}
+	poly_end(d, f->clr);
+}
+
+/*
+ * Data series: min, max, first and last of each column's samples (M4),
+ * worked out a column range per task, then a line from the previous
+ * column's last to the first and one through min and max. Two lines a
+ * column whatever the number of samples, and the same pixels as drawing
+ * every one of them.
+ */
+
+double m4_x0, m4_dx;
+
+void m4_task(void *arg, int i)
+{
+	struct task *t = (struct task *)arg + i;
+
+	series_m4(t->f->series, m4_x0, m4_dx, t->off, t->off + t->n, m4 + t->off);
+}
+
+/* the samples either side of the screen, so lines run off its edges */
+int series_edge(struct series *s, long i, float *x, float *y)
+{
+	if (!series_get(s, i, x, y) || isnan(*y))
+		return 0;
+
+	*x = (*x - m4_x0) / m4_dx;
+	*y = sy_a * *y + sy_b;
+	return 1;
+}
+
+void plot_series(struct dbx *d, struct func *f, int wd)
+{
+	int c, chunk, cnt, prev;
+	float x, y, px = 0, py = 0;
+	u64 start = tickcount_us();
+	struct m4 *m;
+
+	m4_x0 = state.x - state.scale;
+	m4_dx = 2.0 * state.scale / wd;
+
+	chunk = MAX(wd / (pool_threads(pool) * CHUNKS), CHUNK_MIN);
+	cnt = (wd + chunk - 1) / chunk;
+	if (task_reserve(cnt))
+		return;
+	for (c = 0; c < cnt; c++) {
+		tasks[c].f = f;
+		tasks[c].off = c * chunk;
+		tasks[c].n = MIN(wd - c * chunk, chunk);
+	}
+	pool_run(pool, m4_task, tasks, cnt);
+	f->prof.us = tickcount_us() - start;
+
+	/* recounted every frame, NaN y never gets as far as m4 */
+	f->prof.samples = f->prof.out = 0;
+	prev = series_edge(f->series, series_find(f->series, m4_x0) - 1,
+			   &px, &py);
+	for (c = 0; c < wd; c++) {
+		m = &m4[c];
+		if (!m->cnt)
+			continue;
+		f->prof.samples += m->cnt;
+		if (m->max < view_lo || m->min > view_hi)
+			f->prof.out += m->cnt;
+
+		y = sy_a * m->first + sy_b;
+		if (prev)
+			segment(d, px, py, c, y, f->clr);
+		segment(d, c, sy_a * m->min + sy_b, c, sy_a * m->max + sy_b,
+			f->clr);
+		px = c;
+		py = sy_a * m->last + sy_b;
+		prev = 1;
+	}
+
+	if (prev && series_edge(f->series,
+				series_find(f->series, m4_x0 + wd * m4_dx),
+				&x, &y))
+		segment(d, px, py, x, y, f->clr);
+}
+
+/*
+ * Density mode, graph -s <curves>: the #else family (i * 0.6 * sin(x)) / x - 3
+ * with i swept over [0, 10) in that many steps. Each curve adds one to the
+ * pixels it passes through, a span a column between the midpoints to its
+ * neighbours, and the counts are tone mapped on a log scale once a frame.
+ * The family is i * g(x) - 3, so g is worked out once and a curve costs a
+ * multiply-add and two stores a column, see density.h. Every task has
+ * columns of its own.
+ */
+
+#define SWEEP_MAX	65535		/* counts are u16 */
+#define DENSITY_CLR	0x909030
+
+int sweep;
+u16 *hits;
+u32 *image;
+float *dens_g;			/* g(x), a column either side too */
+int dens_wd, dens_ht;
+
+int density_alloc(int wd, int ht)
+{
+	if (wd == dens_wd && ht == dens_ht)
+		return 0;
+
+	free(hits);
+	free(image);
+	free(dens_g);
+	hits = malloc(wd * (ht + 1) * sizeof(*hits));
+	image = malloc(wd * ht * sizeof(*image));
+	dens_g = malloc((wd + 2) * sizeof(*dens_g));
+	if (!hits || !image || !dens_g) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		dens_wd = 0;
+		return -1;
+	}
+	dens_wd = wd;
+	dens_ht = ht;
+	return 0;
+}
+
+void density_task(void *arg, int i)
+{
+	struct task *t = (struct task *)arg + i;
+	float *sy = scratch(t->n + 2), a;
+	u16 *h = hits + t->off * (dens_ht + 1);
+	int j;
+
+	if (!sy)
+		return;
+
+	memset(h, 0, t->n * (dens_ht + 1) * sizeof(*h));
+	for (j = 0; j < sweep; j++) {
+		a = j * 10.0f / sweep;
+		vaxpb(sy, dens_g + t->off, sy_a * a, sy_b - 3.0f * sy_a,
+		      t->n + 2);
+		density_add(h, dens_ht, sy + 1, t->n);
+	}
+	density_sum(h, dens_ht, t->n);
+}
+
+void density(struct dbx *d, int wd, int ht)
+{
+	double x0 = state.x - state.scale, pw = 2.0 * state.scale / wd;
+	float *fx = scratch(wd + 2);
+	int x, c, chunk, cnt;
+
+	if (!fx || density_alloc(wd, ht))
+		return;
+
+	for (x = 0; x < wd + 2; x++)
+		fx[x] = x0 + (x - 1) * pw;
+	vsin(dens_g, fx, wd + 2);
+	vdiv(dens_g, dens_g, fx, wd + 2);
+	vaxpb(dens_g, dens_g, 0.6f, 0.0f, wd + 2);
+
+	chunk = MAX(wd / (pool_threads(pool) * CHUNKS), CHUNK_MIN);
+	cnt = (wd + chunk - 1) / chunk;
+	if (task_reserve(cnt))
+		return;
+	for (c = 0; c < cnt; c++) {
+		tasks[c].f = NULL;
+		tasks[c].off = c * chunk;
+		tasks[c].n = MIN(wd - c * chunk, chunk);
+	}
+	pool_run(pool, density_task, tasks, cnt);
+
+	density_tone(image, hits, wd, ht, DENSITY_CLR);
+	dbx_draw_image(d, 0, 0, wd, ht, image, wd);
+}
+
+/*
+ * Heatmap mode, graph -h 'f(x, y)' or graph -m <iterations> for the escape
+ * time of the Mandelbrot set, under whatever curves are given too. heat.c
+ * keeps the tiles, a frame refines them for FRAME_BUDGET_MS at most, and the
+ * next one carries on while any are still coarse. Sampling the curves gets
+ * what the heatmap leaves of it.
+ */
+
+#define HEAT_BANDS	32.0f		/* LUT entries to a unit of f */
+#define MANDEL_BANDS	8.0f		/* to an escape step */
+
+struct heat *heat;
+struct expr *heat_expr;
+int mandel_iter;
+int heat_busy;			/* tiles left to refine */
+
+void heat_expr_fn(void *arg, float *z, const float *x, float y, int n)
+{
+	float *ys = scratch(n);
+	int i;
+
+	if (!ys) {
+		nan_fill(z, n);
+		return;
+	}
+	for (i = 0; i < n; i++)
+		ys[i] = y;
+	expr_eval_xy(heat_expr, z, x, ys, now, n);
+}
+
+void mandel_fn(void *arg, float *z, const float *x, float y, int n)
+{
+	vmandel(z, x, y, mandel_iter, n);
+}
+
+/*
+ * Profile: p shows a table of what each function's view cost, evaluation
+ * time summed over the threads, samples taken and the share of them that
+ * came out NaN or off the screen, and the lines drawn. DBX_PROF=<file>
+ * appends the same to a CSV, a line per function whenever sampling a view
+ * finishes. A data series' time is its M4 pass, every frame.
+ */
+
+#define PROF_CLR	0xf0ff00
+#define PROF_Y		60		/* clear of the message and live lines */
+#define PROF_ROW	16		/* the 9x15 font */
+#define PROF_NAME	20		/* characters of a function shown */
+
+int prof_shown;
+FILE *prof_csv;
+
+const char *func_name(struct func *f)
+{
+	return f->name ? f->name : f->form ? f->form : "builtin";
+}
+
+float percent(long n, long of)
+{
+	return of ? 100.0f * n / of : 0.0f;
+}
+
+void prof_hud(struct dbx *d)
+{
+	struct prof p;
+	char s[128];
+	int i, n;
+
+	n = snprintf(s, sizeof(s), "%-*s %8s %9s %6s %6s %6s", PROF_NAME,
+		     "function", "eval ms", "samples", "nan%", "out%", "lines");
+	dbx_draw_string(d, 20, PROF_Y, s, n, PROF_CLR);
+
+	for (i = 0; i < func_cnt; i++) {
+		p.us = __atomic_load_n(&funcs[i].prof.us, __ATOMIC_RELAXED);
+		p.samples = __atomic_load_n(&funcs[i].prof.samples,
+					    __ATOMIC_RELAXED);
+		p.nan = __atomic_load_n(&funcs[i].prof.nan, __ATOMIC_RELAXED);
+		p.out = __atomic_load_n(&funcs[i].prof.out, __ATOMIC_RELAXED);
+		n = snprintf(s, sizeof(s), "%-*.*s %8.2f %9ld %6.1f %6.1f %6ld",
+			     PROF_NAME, PROF_NAME, func_name(&funcs[i]),
+			     p.us / 1000.0f, p.samples,
+			     percent(p.nan, p.samples),
+			     percent(p.out, p.samples), funcs[i].prof.segs);
+		dbx_draw_string(d, 20, PROF_Y + (i + 1) * PROF_ROW, s, n,
+				funcs[i].clr);
+	}
+}
+
+int prof_open(void)
+{
+	const char *name = getenv("DBX_PROF");
+
+	if (!name)
+		return 0;
+
+	prof_csv = fopen(name, "a");
+	if (!prof_csv) {
+		perror(name);
+		return -1;
+	}
+	fprintf(prof_csv, "t,function,eval_us,samples,nan,out,lines\n");
+	return 0;
+}
+
+void prof_dump(void)
+{
+	struct prof *p;
+	int i;
+
+	for (i = 0; i < func_cnt; i++) {
+		p = &funcs[i].prof;
+		fprintf(prof_csv, "%.3f,\"%s\",%llu,%ld,%ld,%ld,%ld\n", now,
+			func_name(&funcs[i]), (unsigned long long)p->us,
+			p->samples, p->nan, p->out, p->segs);
+	}
+	fflush(prof_csv);
+}
+
+/* some curve moves with time */
+int timed(void)
+{
+	int i;
+
+	for (i = 0; i < func_cnt; i++)
+		if (funcs[i].flags & FUNC_TIME)
+			return 1;
+	return heat_expr && (expr_flags(heat_expr) & EXPR_TIME);
+}
+
+/* how far the job has got, a bar along the bottom */
+void progress(struct dbx *d, int wd, int ht)
+{
+	int i, ready = wd - 1;
+
+	for (i = 0; i < func_cnt; i++)
+		if (!funcs[i].series)
+			ready = MIN(ready, __atomic_load_n(&funcs[i].ready,
+							   __ATOMIC_ACQUIRE));
+	dbx_fill_rectangle(d, 0, ht - 3, wd, 3, GRIDCLR);
+	dbx_fill_rectangle(d, 0, ht - 3, ready + 1, 3, PROGRESS_CLR);
+}
+
 void graph(struct dbx *d)
 {
 	int ht = dbx_height(d);
 	int wd = dbx_width(d);
-	int px, py, x, y, i;
-	float fx, fy, yscale;
+	float yscale = (float)ht / (float)wd;
+	float ymin = state.y - state.scale * yscale;
+	float ymax = state.y + state.scale * yscale;
+	double pw = 2.0 * state.scale / wd;
+	double step = exp2(floor(log2(pw)));
+	long k0 = floor((state.x - state.scale) / step);
+	u64 start = tickcount_us();	/* the clock, even in a headless run */
+	struct view v;
+	struct cache c;
+	struct func *f;
+	int x, i, ready, done = 0;
+	long used;
+
+	memset(&v, 0, sizeof(v));
+	v.state = state;
+	v.wd = wd;
+	v.ht = ht;
+	v.t = timed() ? uptime() : 0.0f;
+
+	/* a move cancels the job, time only moves on once it is done */
+	if (memcmp(&v, &eval.view, offsetof(struct view, t)) ||
+	    (v.t != eval.view.t && !eval_busy)) {
+		eval_cancel();
+
+		now = uptime();
+		if (columns(wd))
+			return;
+
+		/* from the left edge itself, k0 * step can be a step short */
+		for (x = 0; x < wd; x++)
+			col_k[x] = lround((state.x - state.scale + x * pw) /
+					  step) - k0;
+
+		/* transform(ymin, ymax, fy, ht, 0) as a * fy + b */
+		sy_a = ht / (ymin - ymax);
+		sy_b = -ymax * sy_a;
+		view_lo = ymin + CULL_PX / sy_a;
+		view_hi = ymax - CULL_PX / sy_a;
+
+		if (heat_expr && (expr_flags(heat_expr) & EXPR_TIME))
+			heat_flush(heat);
+		if (!sweep && eval_start(wd, step, k0))
+			return;
+		eval.view = v;
+	}
 
-	for (i = 0; i < ARRAY_SIZE(funcs); i++) {
-		px = -1;
-		for (x = 0; x < wd; x++) {
-			fx = transform(0, wd, x, state.x - state.scale, state.x + state.scale);
+	if (sweep) {
+		density(d, wd, ht);
+		return;
+	}
 
-			fy = funcs[i].func(fx);
+	if (heat)
+		heat_busy = heat_draw(heat, d, pool, state.x - state.scale,
+				      ymax, pw, FRAME_BUDGET_MS);
+
+	/* the one budget, whatever the heatmap took of it */
+	used = tickcount_us() - start;
+	switch (eval_wait(MAX(FRAME_BUDGET_MS * 1000L - used, 0))) {
+	case EVAL_DONE:
+		for (i = 0; i < func_cnt; i++) {
+			c = funcs[i].cache;
+			funcs[i].cache = funcs[i].next;
+			funcs[i].next = c;
+		}
+		done = 1;
+		/* fall through */
+	case EVAL_IDLE:
+		eval_busy = 0;
+		break;
+	default:
+		eval_busy = 1;
+	}
 
-			if (isnan(fy) || !inrange(state.y, state.scale, fy))
-				continue;
-			yscale = (float)ht / (float)wd;
-			y = transform(state.y - state.scale * yscale,
-				      state.y + state.scale * yscale, fy, ht, 0);
-			if (px < 0)
-				dbx_draw_point(d, x, y, funcs[i].clr);
-			else
-				dbx_draw_line(d, px, py, x, y, funcs[i].clr);
-			px = x;
-			py = y;
+	/* drawing stays on this thread, what is sampled so far if not all */
+	for (i = 0; i < func_cnt; i++) {
+		f = &funcs[i];
+		segs = 0;
+		if (f->series) {
+			plot_series(d, f, wd);
+		} else if (!eval_busy) {
+			plot(d, f, &f->cache, wd);
+		} else {
+			ready = __atomic_load_n(&f->ready, __ATOMIC_ACQUIRE);
+			plot(d, f, &f->next, ready + 1);
 		}
+		f->prof.segs = segs;
 	}
+	if (eval_busy)
+		progress(d, wd, ht);
+	if (done && prof_csv)
+		prof_dump();
 }
 #else
 void graph(struct dbx *d)
@@ -340,23 +1600,140 @@ void graph(struct dbx *d)
 }
 #endif
 
+/*
+ * Live series: what the readers have is moved over at the start of every
+ * frame, and the view follows the newest sample unless paused.
+ */
+
+#define DRAIN_CNT	8192
+#define LIVE_KEEP	(1 << 20)	/* samples to scroll back through */
+#define LIVE_KEEP_MAX	(1 << 26)	/* 16 bytes each */
+
+int live_cnt;
+unsigned long long live_bad;	/* samples out of x order */
+
+/* 1 if there were any */
+int drain(void)
+{
+	static float v[2 * DRAIN_CNT];
+	struct func *f;
+	int i, more = 0;
+	long n;
+
+	for (i = 0; i < func_cnt; i++) {
+		f = &funcs[i];
+		if (!f->live)
+			continue;
+		do {
+			n = live_take(f->live, v, DRAIN_CNT);
+			live_bad += n - series_append(f->series, v, n);
+			more |= n > 0;
+		} while (n == DRAIN_CNT);
+	}
+	return more;
+}
+
+void follow(void)
+{
+	float x, y, last = -INFINITY;
+	struct func *f;
+	int i;
+
+	for (i = 0; i < func_cnt; i++) {
+		f = &funcs[i];
+		if (f->live && series_get(f->series,
+					  series_count(f->series) - 1, &x, &y))
+			last = fmaxf(last, x);
+	}
+	if (last > -INFINITY)
+		state.x = last - state.scale;
+}
+
+/* counters over all the streams, and the fullest ring */
+void live_hud(struct dbx *d)
+{
+	unsigned long long rd = 0, drop = 0;
+	struct live_stats st;
+	int i, fill = 0, n;
+	char s[128];
+
+	for (i = 0; i < func_cnt; i++) {
+		if (!funcs[i].live)
+			continue;
+		live_stats(funcs[i].live, &st);
+		rd += st.read;
+		drop += st.dropped;
+		fill = MAX(fill, (int)(st.fill * 100 / st.size));
+	}
+	n = snprintf(s, sizeof(s), "%llu read %llu dropped %llu unordered "
+		     "ring %d%%", rd, drop, live_bad, fill);
+	dbx_draw_string(d, 20, 40, s, n, 0xf0ff00);
+}
+
+/* paused, no key held, no input and no stream: the last frame still stands */
+int idle(struct dbx *d)
+{
+	return paused && !dbx_dirty(d) && !z_in && !z_out &&
+	       !up && !down && !left && !right && !live_cnt && !heat_busy &&
+	       !eval_busy;
+}
+
+/*
+ * The grid is redrawn only when the view moves, the curves also when time
+ * does, and the coordinates and time over them on any input.
+ */
 static int update_display(struct dbx *d)
 {
+	static struct state drawn = { .scale = -1.0f };
+	static float drawn_t = -1.0f;
 	int wd = dbx_width(d);
+	float t;
 
-	dbx_blank_pixmap(d);
+	if (idle(d))
+		return DBX_IDLE;
 
 	update_state();
-	mouse_coord(d);
-
-	draw_grid(d);
+	t = uptime();
 
-	graph(d);
+	if (drain()) {
+		dbx_layer_dirty(d, DBX_LAYER_MAIN);
+		dbx_layer_dirty(d, DBX_LAYER_HUD);
+	}
+	if (!paused)
+		follow();
 
-	dbx_draw_string(d, 20, 20, message, strlen(message), 0xf0ff00);
-	snprintf(timestr, sizeof(timestr) - 1, "%2.3f", uptime());
-	dbx_draw_string(d, wd - 90, 20, timestr, strlen(timestr), 0xf0ff00);
+	if (memcmp(&state, &drawn, sizeof(state))) {
+		dbx_layer_dirty(d, DBX_LAYER_BG);
+		dbx_layer_dirty(d, DBX_LAYER_MAIN);
+		drawn = state;
+	}
+	if ((t != drawn_t && timed()) || heat_busy || eval_busy)
+		dbx_layer_dirty(d, DBX_LAYER_MAIN);
+	if (t != drawn_t || dbx_dirty(d))
+		dbx_layer_dirty(d, DBX_LAYER_HUD);
+	drawn_t = t;
+
+	if (dbx_layer(d, DBX_LAYER_BG))
+		draw_grid(d);
+
+	/* the profile moves on with every frame of the curves */
+	if (dbx_layer(d, DBX_LAYER_MAIN)) {
+		graph(d);
+		if (prof_shown)
+			dbx_layer_dirty(d, DBX_LAYER_HUD);
+	}
 
+	if (dbx_layer(d, DBX_LAYER_HUD)) {
+		mouse_coord(d);
+		dbx_draw_string(d, 20, 20, message, strlen(message), 0xf0ff00);
+		snprintf(timestr, sizeof(timestr) - 1, "%2.3f", t);
+		dbx_draw_string(d, wd - 90, 20, timestr, strlen(timestr),
+				0xf0ff00);
+		if (live_cnt)
+			live_hud(d);
+		if (prof_shown)
+			prof_hud(d);
+	}
 	return 0;
 }
 
@@ -386,6 +1763,9 @@ static int key(struct dbx *d, int code, int key, int press)
 	case '=':
 		z_in = 0;
 		break;
+	case 'p':
+		prof_shown ^= press;
+		break;
 	case 'r':
 		accum = 0.0f;
 		prev_time = tickcount_ms();
@@ -409,6 +1789,198 @@ static int button(struct dbx *d, int button, int x, int y, int press)
 	return 0;
 }
 
+/******************************************************************************/
+
+u32 palette[] = {
+	0x00e0e0, 0xf0f000, 0xf000f0, 0x30e080,
+	0xe05060, 0x80e080, 0xf06060, 0x6060f0,
+};
+
+/* the next funcs[] entry, the first one given replaces the built in table */
+struct func *add_func(void)
+{
+	struct func *f;
+
+	f = realloc(funcs == builtin ? NULL : funcs, (func_cnt + 1) * sizeof(*f));
+	if (!f) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		return NULL;
+	}
+	if (funcs == builtin)
+		func_cnt = 0;
+	funcs = f;
+	f = &funcs[func_cnt];
+	memset(f, 0, sizeof(*f));
+	f->clr = palette[func_cnt % ARRAY_SIZE(palette)];
+	return f;
+}
+
+int add_expr(const char *s)
+{
+	struct func *f = add_func();
+	char err[128];
+
+	if (!f)
+		return -1;
+
+	f->expr = expr_compile(s, err, sizeof(err));
+	if (!f->expr) {
+		fprintf(stderr, "graph: %s: %s\n", s, err);
+		return -1;
+	}
+	if (expr_flags(f->expr) & EXPR_Y) {
+		fprintf(stderr, "graph: %s: y is only for -h\n", s);
+		return -1;
+	}
+	if (expr_flags(f->expr) & EXPR_TIME)
+		f->flags |= FUNC_TIME;
+	f->bound = f->expr;
+	f->name = strdup(s);
+
+	printf("%s\n", s);
+	expr_dump(f->expr);
+	func_cnt++;
+	return 0;
+}
+
+int add_series(const char *name)
+{
+	struct func *f = add_func();
+
+	if (!f)
+		return -1;
+
+	f->name = name;
+	f->series = series_open(name);
+	if (!f->series)
+		return -1;
+
+	printf("%s: %ld samples\n", name, series_count(f->series));
+	func_cnt++;
+	return 0;
+}
+
+/* DBX_LIVE_KEEP overrides LIVE_KEEP, up to LIVE_KEEP_MAX */
+int add_live(const char *name)
+{
+	struct func *f = add_func();
+	char *s = getenv("DBX_LIVE_KEEP");
+
+	if (!f)
+		return -1;
+
+	f->name = name;
+	f->series = series_new(s ? MIN(MAX(atol(s), 1), LIVE_KEEP_MAX) :
+				   LIVE_KEEP);
+	if (!f->series)
+		return -1;
+	f->live = live_open(name);
+	if (!f->live)
+		return -1;
+
+	/* a monitor starts out scrolling */
+	paused = 0;
+	live_cnt++;
+	func_cnt++;
+	return 0;
+}
+
+/* what the readers saw, to tell whether the ring needs to be bigger */
+void live_report(void)
+{
+	struct live_stats st;
+	int i;
+
+	for (i = 0; i < func_cnt; i++) {
+		if (!funcs[i].live)
+			continue;
+		live_stats(funcs[i].live, &st);
+		printf("stream %d: %llu read, %llu dropped, %llu stalls, "
+		       "ring high water %ld of %ld\n", i, st.read, st.dropped,
+		       st.stalls, st.high, st.size);
+		live_close(funcs[i].live);
+		series_close(funcs[i].series);
+	}
+}
+
+int add_heat(heat_fn fn, float bands)
+{
+	if (heat) {
+		fprintf(stderr, "graph: one of -h or -m\n");
+		return -1;
+	}
+	heat = heat_new(fn, NULL, bands);
+	return heat ? 0 : -1;
+}
+
+int add_heat_expr(const char *s)
+{
+	char err[128];
+
+	heat_expr = expr_compile(s, err, sizeof(err));
+	if (!heat_expr) {
+		fprintf(stderr, "graph: %s: %s\n", s, err);
+		return -1;
+	}
+	printf("%s\n", s);
+	expr_dump(heat_expr);
+	return add_heat(heat_expr_fn, HEAT_BANDS);
+}
+
+/* the whole set, a little to the left of the origin */
+int add_mandel(const char *iter)
+{
+	mandel_iter = MAX(atoi(iter), 1);
+	state.x = -0.5f;
+	state.scale = 2.0f;
+	return add_heat(mandel_fn, MANDEL_BANDS);
+}
+
+/* the built in functions' forms */
+int bounds_init(void)
+{
+	char err[128];
+	int i;
+
+	for (i = 0; i < func_cnt; i++) {
+		if (!funcs[i].form)
+			continue;
+		funcs[i].bound = expr_compile(funcs[i].form, err, sizeof(err));
+		if (!funcs[i].bound) {
+			fprintf(stderr, "graph: %s: %s\n", funcs[i].form, err);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* one expression per line, # starts a comment */
+int add_file(const char *name)
+{
+	char line[256], *p;
+	FILE *fp = fopen(name, "r");
+	int ret = 0;
+
+	if (!fp) {
+		perror(name);
+		return -1;
+	}
+
+	while (!ret && fgets(line, sizeof(line), fp)) {
+		if ((p = strchr(line, '#')))
+			*p = '\0';
+		for (p = line + strlen(line);
+		     p > line && isspace((unsigned char)p[-1]); )
+			*--p = '\0';
+		for (p = line; isspace((unsigned char)*p); p++)
+			;
+		if (*p)
+			ret = add_expr(p);
+	}
+	fclose(fp);
+	return ret;
+}
+
 #define UPDATE_PERIOD_MS	30
 int main(int argc, char *argv[])
 {
@@ -419,7 +1991,54 @@ int main(int argc, char *argv[])
 		.key = key,
 		.configure = NULL,
 	};
+	int i;
+
+	/*
+	 * graph [-f file] [-d data] [-l stream] [-s curves]
+	 *       [-h 'f(x, y)' | -m iterations]
+	 *       ['sin(x) / x' ...], the built in table otherwise,
+	 *       or none under a heatmap
+	 */
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			if (add_file(argv[++i]))
+				return EXIT_FAILURE;
+		} else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+			if (add_series(argv[++i]))
+				return EXIT_FAILURE;
+		} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			sweep = atoi(argv[++i]);
+			sweep = MIN(MAX(sweep, 1), SWEEP_MAX);
+		} else if (!strcmp(argv[i], "-h") && i + 1 < argc) {
+			if (add_heat_expr(argv[++i]))
+				return EXIT_FAILURE;
+		} else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+			if (add_mandel(argv[++i]))
+				return EXIT_FAILURE;
+		} else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+			if (add_live(argv[++i]))
+				return EXIT_FAILURE;
+		} else if (add_expr(argv[i])) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (heat && funcs == builtin)
+		func_cnt = 0;
+	if (funcs == builtin && bounds_init())
+		return EXIT_FAILURE;
+
+	if (prof_open())
+		return EXIT_FAILURE;
 
+	pool = pool_create(0);
 	dbx_run(argc, argv, &ops, UPDATE_PERIOD_MS);
+	eval_stop();
+	pool_destroy(pool);
+	heat_free(heat);
+	expr_free(heat_expr);
+	live_report();
+	if (prof_csv)
+		fclose(prof_csv);
 	return EXIT_SUCCESS;
 }
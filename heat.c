@@ -0,0 +1,273 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dbx.h"
+#include "heat.h"
+#include "pool.h"
+
+#define MIN(x, y)	(((x) < (y)) ? (x) : (y))
+
+#define TILE		64		/* pixels a side */
+#define COARSE		8		/* first pass, a sample to 8 x 8 pixels */
+#define LUT_SZ		256
+#define BAND_MAX	1e9f		/* past this z only wraps the LUT */
+
+struct tile {
+	long i, j;		/* on the grid, in tiles, j down */
+	double pw;
+	unsigned gen;
+	int step;		/* pixels to a sample, 0 before the first pass */
+	long dist;		/* from the middle of the screen, squared */
+	u32 *px;
+};
+
+struct heat {
+	heat_fn fn;
+	void *arg;
+	float bands;
+	unsigned gen;
+
+	/* tile (i, j) lives in slot (i mod sw, j mod sh), none on screen share */
+	struct tile *slot;
+	int sw, sh;
+
+	struct tile **shown;	/* on screen, the middle first */
+	struct tile **todo;	/* due a pass, the pool is handed next on */
+	int next;
+
+	u32 lut[LUT_SZ];
+};
+
+/* hue around the wheel, kept dark enough for the grid to show through */
+static void lut_init(u32 *lut)
+{
+	float f;
+	int i, r, g, b;
+
+	for (i = 0; i < LUT_SZ; i++) {
+		f = 2.0f * M_PI * i / LUT_SZ;
+		r = 100.0f + 100.0f * cosf(f);
+		g = 100.0f + 100.0f * cosf(f - 2.0f * M_PI / 3.0f);
+		b = 100.0f + 100.0f * cosf(f + 2.0f * M_PI / 3.0f);
+		lut[i] = RGB(r, g, b);
+	}
+}
+
+struct heat *heat_new(heat_fn fn, void *arg, float bands)
+{
+	struct heat *h = calloc(1, sizeof(*h));
+
+	if (!h) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		return NULL;
+	}
+	h->fn = fn;
+	h->arg = arg;
+	h->bands = bands;
+	lut_init(h->lut);
+	return h;
+}
+
+static void slots_free(struct heat *h)
+{
+	int i;
+
+	for (i = 0; i < h->sw * h->sh; i++)
+		free(h->slot[i].px);
+	free(h->slot);
+	h->slot = NULL;
+	h->sw = h->sh = 0;
+}
+
+void heat_free(struct heat *h)
+{
+	if (!h)
+		return;
+
+	slots_free(h);
+	free(h->shown);
+	free(h->todo);
+	free(h);
+}
+
+void heat_flush(struct heat *h)
+{
+	h->gen++;
+}
+
+static int pow2(int n)
+{
+	int p = 1;
+
+	while (p < n)
+		p <<= 1;
+	return p;
+}
+
+/* nx by ny tiles on screen, and one more each way to pan into */
+static int slots_fit(struct heat *h, int nx, int ny)
+{
+	int sw = pow2(nx + 1), sh = pow2(ny + 1), i;
+
+	if (sw <= h->sw && sh <= h->sh)
+		return 0;
+
+	slots_free(h);
+	free(h->shown);
+	free(h->todo);
+	h->slot = calloc(sw * sh, sizeof(*h->slot));
+	h->shown = malloc(sw * sh * sizeof(*h->shown));
+	h->todo = malloc(sw * sh * sizeof(*h->todo));
+	if (!h->slot || !h->shown || !h->todo) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		free(h->slot);
+		h->slot = NULL;
+		return -1;
+	}
+	for (i = 0; i < sw * sh; i++)
+		h->slot[i].step = -1;
+	h->sw = sw;
+	h->sh = sh;
+	return 0;
+}
+
+/******************************************************************************/
+
+static u32 colour(struct heat *h, float z)
+{
+	float v = z * h->bands;
+
+	/* NaN fails both */
+	if (!(v > -BAND_MAX && v < BAND_MAX))
+		return 0;
+	return h->lut[(int)floorf(v) & (LUT_SZ - 1)];
+}
+
+static void fill(u32 *px, int s, u32 clr)
+{
+	int u, v;
+
+	for (v = 0; v < s; v++, px += TILE)
+		for (u = 0; u < s; u++)
+			px[u] = clr;
+}
+
+/*
+ * The next pass over a tile, at half the last one's step. Rows that pass
+ * did have every other sample already, and each sample paints the block of
+ * pixels down and to the right of it until a finer pass splits that up.
+ */
+static void refine(struct heat *h, struct tile *t)
+{
+	int s = t->step ? t->step / 2 : COARSE, u, u0, du, v, k, n;
+	float x[TILE], z[TILE];
+
+	for (v = 0; v < TILE; v += s) {
+		u0 = t->step && !(v % t->step) ? s : 0;
+		du = u0 ? 2 * s : s;
+		for (n = 0, u = u0; u < TILE; u += du)
+			x[n++] = (t->i * TILE + u) * t->pw;
+
+		h->fn(h->arg, z, x, -(t->j * TILE + v) * t->pw, n);
+
+		for (k = 0, u = u0; k < n; k++, u += du)
+			fill(t->px + v * TILE + u, s, colour(h, z[k]));
+	}
+	t->step = s;
+}
+
+static void tile_task(void *arg, int i)
+{
+	struct heat *h = arg;
+
+	refine(h, h->todo[h->next + i]);
+}
+
+static int nearer(const void *a, const void *b)
+{
+	long da = (*(struct tile **)a)->dist, db = (*(struct tile **)b)->dist;
+
+	return (da > db) - (da < db);
+}
+
+/*
+ * The n shown tiles at step, a handful at a time, until the time is up.
+ * budget_ms < 0 never runs out. 1 if it did.
+ */
+static int pass(struct heat *h, struct pool *p, int n, int step, u64 start,
+		int budget_ms)
+{
+	int i, cnt, late, chunk = pool_threads(p);
+
+	for (i = 0, cnt = 0; i < n; i++)
+		if (h->shown[i]->step == step)
+			h->todo[cnt++] = h->shown[i];
+
+	for (h->next = 0; h->next < cnt; h->next += chunk) {
+		late = tickcount_us() - start >= budget_ms * 1000ULL;
+		if (budget_ms >= 0 && late)
+			return 1;
+		pool_run(p, tile_task, h, MIN(cnt - h->next, chunk));
+	}
+	return 0;
+}
+
+int heat_draw(struct heat *h, struct dbx *d, struct pool *p,
+	      double x0, double y0, double pw, int budget_ms)
+{
+	u64 start = tickcount_us();	/* the clock, even in a headless run */
+	int wd = dbx_width(d), ht = dbx_height(d), nx, ny, mw, mh, n, s;
+	int busy = 0;
+	double ox = floor(x0 / pw + 0.5), oy = floor(-y0 / pw + 0.5);
+	long i0 = floor(ox / TILE), j0 = floor(oy / TILE), i, j, cx, cy;
+	struct tile *t;
+
+	/* the pixel grid the tiles sit on, ox, oy at the top left */
+	nx = floor((ox + wd - 1) / TILE) - i0 + 1;
+	ny = floor((oy + ht - 1) / TILE) - j0 + 1;
+	if (slots_fit(h, nx, ny))
+		return 0;
+	mw = h->sw - 1;
+	mh = h->sh - 1;
+
+	for (j = j0, n = 0; j < j0 + ny; j++)
+		for (i = i0; i < i0 + nx; i++) {
+			t = &h->slot[(j & mh) * h->sw + (i & mw)];
+			if (t->i != i || t->j != j || t->pw != pw ||
+			    t->gen != h->gen || t->step < 0) {
+				t->i = i;
+				t->j = j;
+				t->pw = pw;
+				t->gen = h->gen;
+				t->step = 0;
+			}
+			if (!t->px && !(t->px = malloc(TILE * TILE *
+						       sizeof(*t->px)))) {
+				printf("%s:%d %s()\n", __FILE__, __LINE__,
+				       __func__);
+				return 0;
+			}
+			cx = i * TILE + TILE / 2 - (long)ox - wd / 2;
+			cy = j * TILE + TILE / 2 - (long)oy - ht / 2;
+			t->dist = cx * cx + cy * cy;
+			h->shown[n++] = t;
+		}
+	qsort(h->shown, n, sizeof(*h->shown), nearer);
+
+	/* every tile shows something, however long that takes */
+	pass(h, p, n, 0, start, -1);
+	for (s = COARSE; s > 1; s /= 2)
+		if (pass(h, p, n, s, start, budget_ms))
+			break;
+
+	for (i = 0; i < n; i++) {
+		t = h->shown[i];
+		busy |= t->step != 1;
+		dbx_draw_image(d, t->i * TILE - ox, t->j * TILE - oy,
+			       TILE, TILE, t->px, TILE);
+	}
+	return busy;
+}
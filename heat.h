@@ -0,0 +1,27 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+/*
+ * Heatmaps of z = f(x, y), coloured through a cyclic LUT, bands entries to
+ * a unit of z. The plane is cut into square tiles on a grid fixed to it, so
+ * a pan only works out the tiles it uncovers. A tile starts out a sample to
+ * a block of pixels and is refined by halves while the frame has time left.
+ */
+
+struct dbx;
+struct heat;
+struct pool;
+
+/* z[i] = f(x[i], y) for i < n, NaN where there is none */
+typedef void (*heat_fn)(void *arg, float *z, const float *x, float y, int n);
+
+struct heat *heat_new  (heat_fn fn, void *arg, float bands);
+void         heat_free (struct heat *h);
+void         heat_flush(struct heat *h);	/* f itself has changed */
+
+/*
+ * The view pw units a pixel, with (x0, y0) at the top left. Every tile gets
+ * its first pass, further ones stop after budget_ms. 1 if that left any
+ * tile short of full resolution.
+ */
+int heat_draw(struct heat *h, struct dbx *d, struct pool *p,
+	      double x0, double y0, double pw, int budget_ms);
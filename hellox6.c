@@ -444,7 +444,7 @@ static int update_pixmap(struct dbx *d)
 	int i, r;
 
 	if (_pause)
-		return 0;
+		return DBX_IDLE;
 
 	dbx_blank_pixmap(d);
 
@@ -1,5 +1,7 @@
 /* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
 
+/* 3d3 builds approx.h in ahead of this */
+
 int float_cmp(float a, float range)
 {
 	return fabs(a) < fabs(range) ? 1 : 0;
@@ -35,15 +37,15 @@ float angle2vecz(float phi)
 
 unsigned int ground_clr(float x1, float y1, float x, float y)
 {
-
-	float d = GSCL / sqrt(pow(x - x1, 2) + pow(y - y1, 2));
+	float dx = x - x1, dy = y - y1;
+	float r2 = dx * dx + dy * dy;
 	float gmod = GMOD;
 
-	if (d > 1.0f)
-		d = 1.0f;
+	/* GSCL / distance, no more than 1 */
+	float d = r2 > GSCL * GSCL ? GSCL * approx_rsqrt(r2) : 1.0f;
 
-	x = fmod(x, gmod);
-	y = fmod(y, gmod);
+	x = approx_fmod(x, gmod);
+	y = approx_fmod(y, gmod);
 
 	if (float_cmp(x, GDELT))
 		return GNCLR + (((unsigned int)(GDCLR * d) & 0xff) << GSHFT);
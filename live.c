@@ -0,0 +1,254 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "live.h"
+
+#define MIN(x, y)	(((x) < (y)) ? (x) : (y))
+
+#define RING_SIZE	(1 << 18)	/* about a second at a few 100k/s */
+#define RING_MAX	(1 << 26)	/* samples, 512 MB */
+#define SAMPLE_SZ	(2 * sizeof(float))
+#define READ_CNT	8192		/* samples per read() */
+#define POLL_MS		100		/* how soon live_close() is noticed */
+#define STALL_US	1000
+
+enum { FULL_DROP, FULL_BLOCK };
+
+struct live {
+	char *name;
+	int fd;
+	int full;
+	pthread_t tid;
+	int quit;
+	int eof;
+
+	float *ring;		/* x, y pairs */
+	long mask;
+
+	/* each moved by one side only, apart so they don't share a line */
+	long head __attribute__((aligned(64)));
+	long tail __attribute__((aligned(64)));
+
+	unsigned long long read, dropped, stalls;
+	long high;
+};
+
+/* as many of the n samples at v as there is room for */
+static long ring_put(struct live *l, const float *v, long n)
+{
+	long head = l->head;
+	long fill = head - __atomic_load_n(&l->tail, __ATOMIC_ACQUIRE);
+	long i = head & l->mask, k, a;
+
+	k = MIN(n, l->mask + 1 - fill);
+	a = MIN(k, l->mask + 1 - i);
+	memcpy(l->ring + 2 * i, v, a * SAMPLE_SZ);
+	memcpy(l->ring, v + 2 * a, (k - a) * SAMPLE_SZ);
+	__atomic_store_n(&l->head, head + k, __ATOMIC_RELEASE);
+
+	if (fill + k > l->high)
+		__atomic_store_n(&l->high, fill + k, __ATOMIC_RELAXED);
+	return k;
+}
+
+/* a sample split over two reads is finished by the second */
+static void *reader(void *arg)
+{
+	struct live *l = arg;
+	struct pollfd pfd = { .fd = l->fd, .events = POLLIN };
+	float buf[2 * READ_CNT];
+	size_t have = 0;
+	long n, done;
+	ssize_t r = 0;
+
+	while (!__atomic_load_n(&l->quit, __ATOMIC_RELAXED)) {
+		r = poll(&pfd, 1, POLL_MS);
+		if (r < 0 && errno != EINTR)
+			break;
+		if (r <= 0)
+			continue;
+
+		r = read(l->fd, (char *)buf + have, sizeof(buf) - have);
+		if (r < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (r <= 0)
+			break;
+		have += r;
+		n = have / SAMPLE_SZ;
+
+		done = ring_put(l, buf, n);
+		if (done < n && l->full == FULL_BLOCK)
+			__atomic_add_fetch(&l->stalls, 1, __ATOMIC_RELAXED);
+		while (done < n && l->full == FULL_BLOCK &&
+		       !__atomic_load_n(&l->quit, __ATOMIC_RELAXED)) {
+			usleep(STALL_US);
+			done += ring_put(l, buf + 2 * done, n - done);
+		}
+		__atomic_add_fetch(&l->read, n, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&l->dropped, n - done, __ATOMIC_RELAXED);
+
+		have -= n * SAMPLE_SZ;
+		memmove(buf, (char *)buf + n * SAMPLE_SZ, have);
+	}
+
+	if (r <= 0 && !__atomic_load_n(&l->quit, __ATOMIC_RELAXED))
+		fprintf(stderr, "%s: end of stream\n", l->name);
+	__atomic_store_n(&l->eof, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static int live_connect(const char *name)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (strlen(name) >= sizeof(sa.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", name);
+		return -1;
+	}
+	strcpy(sa.sun_path, name);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&sa, sizeof(sa))) {
+		perror(name);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int live_fd(const char *name)
+{
+	struct stat st;
+	int fd, flags = O_RDONLY;
+
+	if (!strcmp(name, "-"))
+		return dup(STDIN_FILENO);
+
+	if (stat(name, &st)) {
+		if (errno != ENOENT || mkfifo(name, 0600)) {
+			perror(name);
+			return -1;
+		}
+		st.st_mode = S_IFIFO;
+	}
+	if (S_ISSOCK(st.st_mode))
+		return live_connect(name);
+
+	/*
+	 * a FIFO opened for writing too doesn't wait for a producer to open
+	 * it, and doesn't end when one closes it
+	 */
+	if (S_ISFIFO(st.st_mode))
+		flags = O_RDWR;
+	fd = open(name, flags);
+	if (fd < 0)
+		perror(name);
+	return fd;
+}
+
+static long ring_size(void)
+{
+	char *s = getenv("DBX_LIVE_RING");
+	long n = s ? MIN(atol(s), RING_MAX) : RING_SIZE, size = 1;
+
+	while (size < n)
+		size <<= 1;
+	return size;
+}
+
+static int full_policy(void)
+{
+	const char *s = getenv("DBX_LIVE_FULL");
+
+	if (!s || !strcmp(s, "drop"))
+		return FULL_DROP;
+	if (!strcmp(s, "block"))
+		return FULL_BLOCK;
+	printf("DBX_LIVE_FULL should be drop or block\n");
+	return FULL_DROP;
+}
+
+struct live *live_open(const char *name)
+{
+	struct live *l = calloc(1, sizeof(*l));
+	long size = ring_size();
+
+	if (!l || !(l->name = strdup(name)) ||
+	    !(l->ring = malloc(size * SAMPLE_SZ))) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		goto fail;
+	}
+	l->mask = size - 1;
+	l->full = full_policy();
+
+	l->fd = live_fd(name);
+	if (l->fd < 0)
+		goto fail;
+
+	if (pthread_create(&l->tid, NULL, reader, l)) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		close(l->fd);
+		goto fail;
+	}
+	return l;
+
+fail:
+	if (l) {
+		free(l->ring);
+		free(l->name);
+	}
+	free(l);
+	return NULL;
+}
+
+void live_close(struct live *l)
+{
+	if (!l)
+		return;
+
+	__atomic_store_n(&l->quit, 1, __ATOMIC_RELAXED);
+	pthread_join(l->tid, NULL);
+	close(l->fd);
+	free(l->ring);
+	free(l->name);
+	free(l);
+}
+
+/* up to max of the oldest samples in the ring, out of it into xy */
+long live_take(struct live *l, float *xy, long max)
+{
+	long tail = l->tail;
+	long n = __atomic_load_n(&l->head, __ATOMIC_ACQUIRE) - tail;
+	long i = tail & l->mask, a;
+
+	n = MIN(n, max);
+	a = MIN(n, l->mask + 1 - i);
+	memcpy(xy, l->ring + 2 * i, a * SAMPLE_SZ);
+	memcpy(xy + 2 * a, l->ring, (n - a) * SAMPLE_SZ);
+	__atomic_store_n(&l->tail, tail + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+void live_stats(struct live *l, struct live_stats *st)
+{
+	st->read = __atomic_load_n(&l->read, __ATOMIC_RELAXED);
+	st->dropped = __atomic_load_n(&l->dropped, __ATOMIC_RELAXED);
+	st->stalls = __atomic_load_n(&l->stalls, __ATOMIC_RELAXED);
+	st->fill = __atomic_load_n(&l->head, __ATOMIC_ACQUIRE) - l->tail;
+	st->high = __atomic_load_n(&l->high, __ATOMIC_RELAXED);
+	st->size = l->mask + 1;
+	st->eof = __atomic_load_n(&l->eof, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,27 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+/*
+ * Samples streamed in by another process, native float (x, y) pairs as in
+ * series files, from stdin ("-"), a FIFO (made if missing) or a UNIX stream
+ * socket. A thread of their own reads them into a single producer, single
+ * consumer ring that live_take() empties without ever blocking. When the
+ * ring is full the reader drops what doesn't fit, or with DBX_LIVE_FULL=block
+ * stops reading so the pipe fills and holds the producer up instead.
+ * DBX_LIVE_RING sets the ring size in samples, 64M at most.
+ */
+
+struct live;
+
+struct live_stats {
+	unsigned long long read;	/* samples read */
+	unsigned long long dropped;	/* of those, lost to a full ring */
+	unsigned long long stalls;	/* times the reader waited for room */
+	long fill, high, size;		/* samples in the ring, most ever, room */
+	int eof;			/* the producer went away */
+};
+
+struct live *live_open (const char *name);
+void         live_close(struct live *l);
+
+long live_take (struct live *l, float *xy, long max);
+void live_stats(struct live *l, struct live_stats *st);
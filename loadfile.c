@@ -16,13 +16,13 @@ const char *loadfile(char *fname)
 	FILE *f;
 
 	if (stat(fname, &st)) {
-		printf("%s (%d)%s", fname, errno, strerror(errno));
+		printf("%s (%d)%s\n", fname, errno, strerror(errno));
 		return NULL;
 	}
 
 	f = fopen(fname, "rb");
 	if (!f) {
-		printf("%s (%d)%s", fname, errno, strerror(errno));
+		printf("%s (%d)%s\n", fname, errno, strerror(errno));
 		return NULL;
 	}
 
@@ -34,7 +34,7 @@ const char *loadfile(char *fname)
 	if (sz != st.st_size) {
 		free(b);
 		fclose(f);
-		printf("[%d:%d] %s (%d)%s", (int)sz, (int)st.st_size,
+		printf("[%d:%d] %s (%d)%s\n", (int)sz, (int)st.st_size,
 			fname, errno, strerror(errno));
 		return NULL;
 	}
@@ -206,6 +206,8 @@ static int update_pixmap(struct dbx *d)
 	int i, r;
 
 	if (paused) {
+		if (!dbx_dirty(d))
+			return DBX_IDLE;
 		snprintf(msg, sizeof(msg), "PRESS SPACE TO TOGGLE PAUSE");
 		dbx_draw_string(d, 100, 100, msg, strlen(msg), 0xf0ff00);
 		return 0;
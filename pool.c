@@ -0,0 +1,158 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+struct pool {
+	pthread_mutex_t run;	/* held by the caller whose job it is */
+	pthread_mutex_t lock;
+	pthread_cond_t work, done;
+	pthread_t *tid;
+	int workers;
+	int quit;
+
+	/* the job being run, gen tells the workers a new one is up */
+	void (*fn)(void *arg, int i);
+	void *arg;
+	int cnt;
+	int next;		/* next index to hand out */
+	int busy;		/* workers not yet back from the job */
+	unsigned gen;
+};
+
+/* everybody takes indices off the same counter until they run out */
+static void run_job(struct pool *p)
+{
+	int i;
+
+	while ((i = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED)) < p->cnt)
+		p->fn(p->arg, i);
+}
+
+static void *worker(void *arg)
+{
+	struct pool *p = arg;
+	unsigned gen = 0;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (!p->quit && p->gen == gen)
+			pthread_cond_wait(&p->work, &p->lock);
+		if (p->quit)
+			break;
+		gen = p->gen;
+		pthread_mutex_unlock(&p->lock);
+
+		run_job(p);
+
+		pthread_mutex_lock(&p->lock);
+		if (!--p->busy)
+			pthread_cond_signal(&p->done);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+static int default_threads(void)
+{
+	char *s = getenv("DBX_THREADS");
+	long n = s ? atoi(s) : sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? n : 1;
+}
+
+struct pool *pool_create(int threads)
+{
+	struct pool *p = calloc(1, sizeof(*p));
+	int i;
+
+	if (threads <= 0)
+		threads = default_threads();
+
+	if (!p || !(p->tid = calloc(threads, sizeof(*p->tid)))) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		free(p);
+		return NULL;
+	}
+	pthread_mutex_init(&p->run, NULL);
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->work, NULL);
+	pthread_cond_init(&p->done, NULL);
+
+	/* the caller is one of the threads */
+	for (i = 0; i < threads - 1; i++) {
+		if (pthread_create(&p->tid[i], NULL, worker, p)) {
+			printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+			break;
+		}
+		p->workers++;
+	}
+	return p;
+}
+
+void pool_destroy(struct pool *p)
+{
+	int i;
+
+	if (!p)
+		return;
+
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->lock);
+
+	for (i = 0; i < p->workers; i++)
+		pthread_join(p->tid[i], NULL);
+
+	pthread_cond_destroy(&p->done);
+	pthread_cond_destroy(&p->work);
+	pthread_mutex_destroy(&p->lock);
+	pthread_mutex_destroy(&p->run);
+	free(p->tid);
+	free(p);
+}
+
+int pool_threads(struct pool *p)
+{
+	return p ? p->workers + 1 : 1;
+}
+
+void pool_run(struct pool *p, void (*fn)(void *arg, int i), void *arg, int cnt)
+{
+	int i;
+
+	/*
+	 * not worth waking anybody, or they are busy with another thread's
+	 * job, which this one shouldn't wait behind
+	 */
+	if (!p || !p->workers || cnt < 2 || pthread_mutex_trylock(&p->run)) {
+		for (i = 0; i < cnt; i++)
+			fn(arg, i);
+		return;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->fn = fn;
+	p->arg = arg;
+	p->cnt = cnt;
+	p->next = 0;
+	p->busy = p->workers;
+	p->gen++;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->lock);
+
+	run_job(p);
+
+	/* workers late to wake find nothing left, but the job stays theirs
+	 * until they check back in */
+	pthread_mutex_lock(&p->lock);
+	while (p->busy)
+		pthread_cond_wait(&p->done, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+	pthread_mutex_unlock(&p->run);
+}
@@ -0,0 +1,16 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+/*
+ * Persistent worker threads. pool_run() calls fn(arg, i) for every i < cnt,
+ * spread over the workers and the calling thread, and returns when all of
+ * them are done. A caller that finds the workers on another thread's job
+ * runs its own all by itself.
+ */
+
+struct pool;
+
+struct pool *pool_create (int threads);	/* <= 0: DBX_THREADS or one per cpu */
+void         pool_destroy(struct pool *p);
+int          pool_threads(struct pool *p);
+
+void pool_run(struct pool *p, void (*fn)(void *arg, int i), void *arg, int cnt);
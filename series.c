@@ -0,0 +1,472 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "series.h"
+
+#define MIN(x, y)	(((x) < (y)) ? (x) : (y))
+
+/*
+ * Level of detail: min and max of y over buckets of LOD_BASE << l samples
+ * for every level l, finest first, as long as a whole bucket fits. Kept
+ * next to the data in name.lod and mapped, built when that's missing or
+ * older than the data.
+ */
+
+#define LOD_BASE	16
+#define LOD_LEVELS	48
+#define LOD_MIN		(1 << 16)	/* scanning fewer samples is cheap */
+#define LOD_MAGIC	"dbxlod2"
+
+struct lod_hdr {
+	char magic[8];
+	long long size;		/* of the data when built */
+	long long mtime, mtime_ns;
+	long long cnt;
+	int base, levels;
+};
+
+struct series {
+	const float *p;		/* x, y pairs */
+	long cnt;
+	void *map;		/* the file's, when p points into it */
+	size_t map_sz;
+
+	const float *lod;	/* min, max pairs */
+	long lod_off[LOD_LEVELS];
+	int levels;
+	void *lod_map;		/* mapped, or malloc()ed if it couldn't be saved */
+	size_t lod_sz;
+
+	long keep;		/* series_new()'s, room for twice that */
+};
+
+static void *map_file(const char *name, struct stat *st)
+{
+	void *p;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, st) || !st->st_size) {
+		close(fd);
+		return NULL;
+	}
+
+	p = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+/* lines are copied out first, the mapping has no terminating NUL */
+static int parse_csv(struct series *s, const char *t, size_t sz)
+{
+	const char *end = t + sz, *nl;
+	char line[128], *p, *q;
+	long cap = 0, n = 0;
+	float x, y, *v;
+
+	for (; t < end; t = nl + 1) {
+		nl = memchr(t, '\n', end - t);
+		if (!nl)
+			nl = end;
+		if ((size_t)(nl - t) >= sizeof(line))
+			continue;
+		memcpy(line, t, nl - t);
+		line[nl - t] = '\0';
+
+		for (p = line; isspace((unsigned char)*p); p++)
+			;
+		if (*p == '#' || !*p)
+			continue;
+		x = strtof(p, &q);
+		if (q == p)
+			continue;	/* a header */
+		for (p = q; isspace((unsigned char)*p) || *p == ','; p++)
+			;
+		y = strtof(p, &q);
+		if (q == p) {
+			y = x;
+			x = n;
+		}
+
+		if (n == cap) {
+			cap = cap ? cap * 2 : 4096;
+			v = realloc((float *)s->p, cap * 2 * sizeof(*v));
+			if (!v) {
+				printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+				return -1;
+			}
+			s->p = v;
+		}
+		v = (float *)s->p + 2 * n++;
+		v[0] = x;
+		v[1] = y;
+	}
+	s->cnt = n;
+	return 0;
+}
+
+/* y min and max over samples i to j - 1, NaN never passes a compare */
+static void raw_minmax(struct series *s, long i, long j, float *lo, float *hi)
+{
+	const float *p = s->p + 1;
+	float l = *lo, h = *hi;
+
+	for (; i < j; i++) {
+		l = p[2 * i] < l ? p[2 * i] : l;
+		h = p[2 * i] > h ? p[2 * i] : h;
+	}
+	*lo = l;
+	*hi = h;
+}
+
+static long lod_buckets(long cnt, int l)
+{
+	return cnt / ((long)LOD_BASE << l);
+}
+
+static void lod_layout(struct series *s)
+{
+	long off = 0;
+	int l;
+
+	for (l = 0; l < LOD_LEVELS && lod_buckets(s->cnt, l); l++) {
+		s->lod_off[l] = off;
+		off += 2 * lod_buckets(s->cnt, l);
+	}
+	s->levels = l;
+}
+
+static char *lod_name(const char *name)
+{
+	char *p = malloc(strlen(name) + 5);
+
+	if (p)
+		sprintf(p, "%s.lod", name);
+	return p;
+}
+
+static int lod_map(struct series *s, const char *name, struct stat *data)
+{
+	char *lname = lod_name(name);
+	struct lod_hdr *h;
+	struct stat st;
+
+	if (!lname)
+		return -1;
+
+	h = map_file(lname, &st);
+	free(lname);
+	if (!h)
+		return -1;
+
+	lod_layout(s);
+	if (st.st_size < sizeof(*h) || memcmp(h->magic, LOD_MAGIC, 8) ||
+	    h->size != data->st_size || h->mtime != data->st_mtime ||
+	    h->mtime_ns != data->st_mtim.tv_nsec ||
+	    h->cnt != s->cnt || h->base != LOD_BASE ||
+	    h->levels != s->levels ||
+	    st.st_size != sizeof(*h) + (s->lod_off[s->levels - 1] + 2) *
+				       sizeof(float)) {
+		munmap(h, st.st_size);
+		return -1;
+	}
+
+	s->lod_map = h;
+	s->lod_sz = st.st_size;
+	s->lod = (const float *)(h + 1);
+	return 0;
+}
+
+/* each level from the one below, written to name.lod if it can be */
+static int lod_build(struct series *s, const char *name, struct stat *data)
+{
+	long i, n, sz;
+	struct lod_hdr *h;
+	char *lname, *tmp;
+	const float *c;
+	float *v, *b;
+	int l, ok;
+	FILE *fp;
+
+	printf("%s: building the level of detail index\n", name);
+	lod_layout(s);
+	sz = sizeof(*h) + (s->lod_off[s->levels - 1] + 2) * sizeof(float);
+	h = calloc(1, sz);
+	if (!h) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		return -1;
+	}
+	memcpy(h->magic, LOD_MAGIC, 8);
+	h->size = data->st_size;
+	h->mtime = data->st_mtime;
+	h->mtime_ns = data->st_mtim.tv_nsec;
+	h->cnt = s->cnt;
+	h->base = LOD_BASE;
+	h->levels = s->levels;
+
+	v = (float *)(h + 1);
+	for (i = 0, b = v; i < lod_buckets(s->cnt, 0); i++, b += 2) {
+		b[0] = INFINITY;
+		b[1] = -INFINITY;
+		raw_minmax(s, i * LOD_BASE, (i + 1) * LOD_BASE, &b[0], &b[1]);
+	}
+	for (l = 1; l < s->levels; l++) {
+		n = lod_buckets(s->cnt, l);
+		c = v + s->lod_off[l - 1];
+		for (i = 0, b = v + s->lod_off[l]; i < n; i++, b += 2, c += 4) {
+			b[0] = fminf(c[0], c[2]);
+			b[1] = fmaxf(c[1], c[3]);
+		}
+	}
+
+	s->lod_map = h;
+	s->lod = v;
+
+	lname = lod_name(name);
+	tmp = lname ? malloc(strlen(lname) + 5) : NULL;
+	if (!tmp) {
+		free(lname);
+		return 0;
+	}
+	sprintf(tmp, "%s.tmp", lname);
+	fp = fopen(tmp, "wb");
+	ok = fp && fwrite(h, sz, 1, fp) == 1;
+	if (fp && fclose(fp))
+		ok = 0;
+	if (!ok || rename(tmp, lname)) {
+		fprintf(stderr, "%s: not saved, kept in memory\n", lname);
+		unlink(tmp);
+	}
+	free(tmp);
+	free(lname);
+	return 0;
+}
+
+static int is_csv(const char *name)
+{
+	size_t len = strlen(name);
+
+	return len > 4 && !strcasecmp(name + len - 4, ".csv");
+}
+
+struct series *series_open(const char *name)
+{
+	struct series *s = calloc(1, sizeof(*s));
+	struct stat st;
+	void *map;
+	long i;
+
+	if (!s) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		return NULL;
+	}
+
+	map = map_file(name, &st);
+	if (!map) {
+		fprintf(stderr, "%s: can't map, or empty\n", name);
+		goto fail;
+	}
+
+	if (is_csv(name)) {
+		i = parse_csv(s, map, st.st_size);
+		munmap(map, st.st_size);
+		if (i)
+			goto fail;
+	} else {
+		s->map = map;
+		s->map_sz = st.st_size;
+		s->p = map;
+		s->cnt = st.st_size / (2 * sizeof(*s->p));
+		madvise(map, st.st_size, MADV_WILLNEED);
+	}
+
+	if (!s->cnt) {
+		fprintf(stderr, "%s: no samples\n", name);
+		goto fail;
+	}
+	if (s->cnt < LOD_MIN)
+		goto check;
+
+	/* a good name.lod was only ever built after the check below */
+	if (!lod_map(s, name, &st))
+		return s;
+
+check:
+	/* series_find() bisects on x */
+	for (i = 0; i < s->cnt; i++)
+		if (!(i ? s->p[2 * i] >= s->p[2 * i - 2] : !isnan(s->p[0]))) {
+			fprintf(stderr, "%s: x not ascending at sample %ld\n",
+				name, i);
+			goto fail;
+		}
+
+	if (s->cnt >= LOD_MIN && lod_build(s, name, &st))
+		goto fail;
+	return s;
+
+fail:
+	series_close(s);
+	return NULL;
+}
+
+void series_close(struct series *s)
+{
+	if (!s)
+		return;
+
+	if (s->map)
+		munmap(s->map, s->map_sz);
+	else
+		free((float *)s->p);
+	if (s->lod && s->lod_sz)
+		munmap(s->lod_map, s->lod_sz);
+	else
+		free(s->lod_map);
+	free(s);
+}
+
+long series_count(struct series *s)
+{
+	return s->cnt;
+}
+
+struct series *series_new(long keep)
+{
+	struct series *s = calloc(1, sizeof(*s));
+
+	if (!s || !(s->p = malloc(2 * keep * 2 * sizeof(*s->p)))) {
+		printf("%s:%d %s()\n", __FILE__, __LINE__, __func__);
+		free(s);
+		return NULL;
+	}
+	s->keep = keep;
+	return s;
+}
+
+/* once full, the newest keep samples move down, once every keep samples */
+long series_append(struct series *s, const float *xy, long n)
+{
+	float *p = (float *)s->p, last = s->cnt ? p[2 * s->cnt - 2] : -INFINITY;
+	long i, k = 0;
+
+	for (i = 0; i < n; i++, xy += 2) {
+		if (!(xy[0] >= last))
+			continue;
+		if (s->cnt == 2 * s->keep) {
+			memmove(p, p + 2 * s->keep, 2 * s->keep * sizeof(*p));
+			s->cnt = s->keep;
+		}
+		p[2 * s->cnt] = last = xy[0];
+		p[2 * s->cnt + 1] = xy[1];
+		s->cnt++;
+		k++;
+	}
+	return k;
+}
+
+/* first sample at or past x, from lo on */
+static long find(struct series *s, long lo, double x)
+{
+	long hi = s->cnt, m;
+
+	while (lo < hi) {
+		m = lo + (hi - lo) / 2;
+		if (s->p[2 * m] < x)
+			lo = m + 1;
+		else
+			hi = m;
+	}
+	return lo;
+}
+
+long series_find(struct series *s, double x)
+{
+	return find(s, 0, x);
+}
+
+int series_get(struct series *s, long i, float *x, float *y)
+{
+	if (i < 0 || i >= s->cnt)
+		return 0;
+
+	*x = s->p[2 * i];
+	*y = s->p[2 * i + 1];
+	return 1;
+}
+
+/*
+ * min and max over i to j - 1 from the biggest buckets that fit, raw
+ * samples only up to the first bucket edge and past the last one, about
+ * two buckets per level in between
+ */
+static void lod_minmax(struct series *s, long i, long j, float *lo, float *hi)
+{
+	const float *b;
+	long size, e;
+	int l;
+
+	while (i < j) {
+		for (l = s->levels - 1; l >= 0; l--) {
+			size = (long)LOD_BASE << l;
+			if (!(i & (size - 1)) && i + size <= j)
+				break;
+		}
+		if (l < 0) {
+			e = MIN((i | (LOD_BASE - 1)) + 1, j);
+			raw_minmax(s, i, e, lo, hi);
+			i = e;
+			continue;
+		}
+
+		b = s->lod + s->lod_off[l] + 2 * ((i >> l) / LOD_BASE);
+		*lo = b[0] < *lo ? b[0] : *lo;
+		*hi = b[1] > *hi ? b[1] : *hi;
+		i += size;
+	}
+}
+
+/*
+ * Each column's end is bisected for, then its min and max come from the
+ * level of detail index, or a pass over its samples without one.
+ */
+void series_m4(struct series *s, double x0, double dx, int c0, int c1,
+	       struct m4 *m)
+{
+	long i = find(s, 0, x0 + c0 * dx), j, k;
+	const float *p;
+	int c;
+
+	for (c = c0; c < c1; c++, m++, i = j) {
+		j = find(s, i, x0 + (c + 1) * dx);
+
+		/* no further than the first and last that aren't NaN */
+		for (p = s->p + 1; i < j && isnan(p[2 * i]); i++)
+			;
+		for (k = j; k > i && isnan(p[2 * k - 2]); k--)
+			;
+		m->cnt = k - i;
+		if (!m->cnt)
+			continue;
+
+		m->first = p[2 * i];
+		m->last = p[2 * k - 2];
+		m->min = INFINITY;
+		m->max = -INFINITY;
+		if (s->lod)
+			lod_minmax(s, i, k, &m->min, &m->max);
+		else
+			raw_minmax(s, i, k, &m->min, &m->max);
+	}
+}
@@ -0,0 +1,35 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+/*
+ * Recorded (x, y) samples with x ascending. Files are native float pairs,
+ * mapped as they are, except *.csv which is parsed into memory once: "x, y"
+ * a line, or just y with the sample number for x. # starts a comment.
+ */
+
+struct series;
+
+/* one pixel column's samples as M4 keeps them, NaN y left out */
+struct m4 {
+	float first, last;
+	float min, max;
+	long cnt;		/* samples from first to last */
+};
+
+struct series *series_open (const char *name);
+void           series_close(struct series *s);
+long           series_count(struct series *s);
+
+/*
+ * In memory and appended to, at least the newest keep samples kept. Those
+ * with x NaN or below the last one are left out, the count appended is
+ * returned.
+ */
+struct series *series_new   (long keep);
+long           series_append(struct series *s, const float *xy, long n);
+
+long series_find(struct series *s, double x);	/* first sample at or past x */
+int  series_get (struct series *s, long i, float *x, float *y);
+
+/* columns c0 to c1 - 1, dx wide, column 0 starting at x0 */
+void series_m4(struct series *s, double x0, double dx, int c0, int c1,
+	       struct m4 *m);
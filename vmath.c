@@ -0,0 +1,500 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "approx.h"
+#include "vmath.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VMATH_X86
+#endif
+
+enum { ISA_SCALAR, ISA_SSE, ISA_AVX2 };
+
+static const char *isa_names[] = { "scalar", "sse2", "avx2" };
+
+/*
+ * Worked out in a local and published once, so pool threads racing through
+ * their first call all see the final level, never the scalar start of it
+ */
+static int isa(void)
+{
+	static int level = -1;
+	int l = __atomic_load_n(&level, __ATOMIC_RELAXED);
+
+	if (l >= 0)
+		return l;
+
+	l = ISA_SCALAR;
+#ifdef VMATH_X86
+	const char *s = getenv("VMATH");
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		l = ISA_SSE;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		l = ISA_AVX2;
+
+	if (s && !strcmp(s, "scalar"))
+		l = ISA_SCALAR;
+	else if (s && !strcmp(s, "sse2") && l > ISA_SSE)
+		l = ISA_SSE;
+#endif
+	__atomic_store_n(&level, l, __ATOMIC_RELAXED);
+	return l;
+}
+
+const char *vmath_isa(void)
+{
+	return isa_names[isa()];
+}
+
+/******************************************************************************/
+
+/*
+ * sin and cos from one range reduction to [-pi/4, pi/4] in three parts
+ * (Cody-Waite) and a minimax polynomial for each, as in the Cephes sinf.
+ * Past SC_MAX the reduction runs out of bits and libm takes over.
+ */
+
+/* approx.h has the constants, and the same thing an element at a time */
+#define FOPI	APPROX_FOPI
+#define DP1	APPROX_DP1
+#define DP2	APPROX_DP2
+#define DP3	APPROX_DP3
+#define SC_MAX	APPROX_SC_MAX
+
+#define S0	APPROX_S0
+#define S1	APPROX_S1
+#define S2	APPROX_S2
+#define C0	APPROX_C0
+#define C1	APPROX_C1
+#define C2	APPROX_C2
+
+enum { OP_SIN, OP_COS, OP_TAN };
+
+static float sincos_scalar(float x, int op)
+{
+	switch (op) {
+	case OP_SIN: return sinf(x);
+	case OP_COS: return cosf(x);
+	}
+	return tanf(x);
+}
+
+/*
+ * z = z^2 + c until |z| passes MANDEL_R, the step count then has the last
+ * |z| folded in so it doesn't band: k + 1 - log2(log2 |z|). The larger the
+ * radius the closer that gets to continuous.
+ */
+
+#define MANDEL_R2	256.0f		/* radius 16, squared */
+
+static float mandel_smooth(int k, float m2)
+{
+	if (m2 <= MANDEL_R2)
+		return NAN;
+	return k + 1 - log2f(0.5f * log2f(m2));
+}
+
+static float mandel_scalar(float cr, float ci, int iter)
+{
+	float zr = 0.0f, zi = 0.0f, t;
+	int k;
+
+	for (k = 0; k < iter && zr * zr + zi * zi <= MANDEL_R2; k++) {
+		t = zr * zr - zi * zi + cr;
+		zi = 2.0f * zr * zi + ci;
+		zr = t;
+	}
+	return mandel_smooth(k, zr * zr + zi * zi);
+}
+
+#ifdef VMATH_X86
+
+/* each kernel does whole vectors and returns how many elements that was */
+
+static int sincos_sse(float *y, const float *x, int n, int op)
+{
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128i two = _mm_set1_epi32(2);
+	const __m128i four = _mm_set1_epi32(4);
+	__m128 v, ax, fj, z, ps, pc, pmask, ssign, csign, s, c;
+	__m128i j;
+	int i, k;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm_loadu_ps(x + i);
+		ax = _mm_andnot_ps(sign, v);
+		if (_mm_movemask_ps(_mm_cmpgt_ps(ax, _mm_set1_ps(SC_MAX)))) {
+			for (k = i; k < i + 4; k++)
+				y[k] = sincos_scalar(x[k], op);
+			continue;
+		}
+
+		/* octant, rounded up to even */
+		j = _mm_cvttps_epi32(_mm_mul_ps(ax, _mm_set1_ps(FOPI)));
+		j = _mm_andnot_si128(one, _mm_add_epi32(j, one));
+		fj = _mm_cvtepi32_ps(j);
+
+		ssign = _mm_xor_ps(_mm_and_ps(v, sign),
+				   _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j, four), 29)));
+		csign = _mm_castsi128_ps(_mm_slli_epi32(
+				_mm_andnot_si128(_mm_sub_epi32(j, two), four), 29));
+		pmask = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, two),
+							 _mm_setzero_si128()));
+
+		ax = _mm_sub_ps(ax, _mm_mul_ps(fj, _mm_set1_ps(DP1)));
+		ax = _mm_sub_ps(ax, _mm_mul_ps(fj, _mm_set1_ps(DP2)));
+		ax = _mm_sub_ps(ax, _mm_mul_ps(fj, _mm_set1_ps(DP3)));
+		z = _mm_mul_ps(ax, ax);
+
+		pc = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(C0), z), _mm_set1_ps(C1));
+		pc = _mm_add_ps(_mm_mul_ps(pc, z), _mm_set1_ps(C2));
+		pc = _mm_mul_ps(_mm_mul_ps(pc, z), z);
+		pc = _mm_sub_ps(pc, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+		pc = _mm_add_ps(pc, _mm_set1_ps(1.0f));
+
+		ps = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(S0), z), _mm_set1_ps(S1));
+		ps = _mm_add_ps(_mm_mul_ps(ps, z), _mm_set1_ps(S2));
+		ps = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ps, z), ax), ax);
+
+		s = _mm_or_ps(_mm_and_ps(pmask, ps), _mm_andnot_ps(pmask, pc));
+		c = _mm_or_ps(_mm_and_ps(pmask, pc), _mm_andnot_ps(pmask, ps));
+		s = _mm_xor_ps(s, ssign);
+		c = _mm_xor_ps(c, csign);
+
+		switch (op) {
+		case OP_SIN: _mm_storeu_ps(y + i, s); break;
+		case OP_COS: _mm_storeu_ps(y + i, c); break;
+		case OP_TAN: _mm_storeu_ps(y + i, _mm_div_ps(s, c)); break;
+		}
+	}
+	return i;
+}
+
+__attribute__((target("avx2,fma")))
+static int sincos_avx2(float *y, const float *x, int n, int op)
+{
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i two = _mm256_set1_epi32(2);
+	const __m256i four = _mm256_set1_epi32(4);
+	__m256 v, ax, fj, z, ps, pc, pmask, ssign, csign, s, c;
+	__m256i j;
+	int i, k;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm256_loadu_ps(x + i);
+		ax = _mm256_andnot_ps(sign, v);
+		if (_mm256_movemask_ps(_mm256_cmp_ps(ax, _mm256_set1_ps(SC_MAX),
+						     _CMP_GT_OQ))) {
+			for (k = i; k < i + 8; k++)
+				y[k] = sincos_scalar(x[k], op);
+			continue;
+		}
+
+		j = _mm256_cvttps_epi32(_mm256_mul_ps(ax, _mm256_set1_ps(FOPI)));
+		j = _mm256_andnot_si256(one, _mm256_add_epi32(j, one));
+		fj = _mm256_cvtepi32_ps(j);
+
+		ssign = _mm256_xor_ps(_mm256_and_ps(v, sign),
+				      _mm256_castsi256_ps(_mm256_slli_epi32(
+					      _mm256_and_si256(j, four), 29)));
+		csign = _mm256_castsi256_ps(_mm256_slli_epi32(
+				_mm256_andnot_si256(_mm256_sub_epi32(j, two), four), 29));
+		pmask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+				_mm256_and_si256(j, two), _mm256_setzero_si256()));
+
+		ax = _mm256_fnmadd_ps(fj, _mm256_set1_ps(DP1), ax);
+		ax = _mm256_fnmadd_ps(fj, _mm256_set1_ps(DP2), ax);
+		ax = _mm256_fnmadd_ps(fj, _mm256_set1_ps(DP3), ax);
+		z = _mm256_mul_ps(ax, ax);
+
+		pc = _mm256_fmadd_ps(_mm256_set1_ps(C0), z, _mm256_set1_ps(C1));
+		pc = _mm256_fmadd_ps(pc, z, _mm256_set1_ps(C2));
+		pc = _mm256_mul_ps(_mm256_mul_ps(pc, z), z);
+		pc = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), pc);
+		pc = _mm256_add_ps(pc, _mm256_set1_ps(1.0f));
+
+		ps = _mm256_fmadd_ps(_mm256_set1_ps(S0), z, _mm256_set1_ps(S1));
+		ps = _mm256_fmadd_ps(ps, z, _mm256_set1_ps(S2));
+		ps = _mm256_fmadd_ps(_mm256_mul_ps(ps, z), ax, ax);
+
+		s = _mm256_blendv_ps(pc, ps, pmask);
+		c = _mm256_blendv_ps(ps, pc, pmask);
+		s = _mm256_xor_ps(s, ssign);
+		c = _mm256_xor_ps(c, csign);
+
+		switch (op) {
+		case OP_SIN: _mm256_storeu_ps(y + i, s); break;
+		case OP_COS: _mm256_storeu_ps(y + i, c); break;
+		case OP_TAN: _mm256_storeu_ps(y + i, _mm256_div_ps(s, c)); break;
+		}
+	}
+	return i;
+}
+
+static int powi_sse(float *y, const float *x, int e, int n)
+{
+	__m128 r, b;
+	int i, k;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		r = _mm_set1_ps(1.0f);
+		b = _mm_loadu_ps(x + i);
+		for (k = abs(e); k; k >>= 1, b = _mm_mul_ps(b, b))
+			if (k & 1)
+				r = _mm_mul_ps(r, b);
+		if (e < 0)
+			r = _mm_div_ps(_mm_set1_ps(1.0f), r);
+		_mm_storeu_ps(y + i, r);
+	}
+	return i;
+}
+
+__attribute__((target("avx2,fma")))
+static int powi_avx2(float *y, const float *x, int e, int n)
+{
+	__m256 r, b;
+	int i, k;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		r = _mm256_set1_ps(1.0f);
+		b = _mm256_loadu_ps(x + i);
+		for (k = abs(e); k; k >>= 1, b = _mm256_mul_ps(b, b))
+			if (k & 1)
+				r = _mm256_mul_ps(r, b);
+		if (e < 0)
+			r = _mm256_div_ps(_mm256_set1_ps(1.0f), r);
+		_mm256_storeu_ps(y + i, r);
+	}
+	return i;
+}
+
+static int rcp_sse(float *y, const float *x, int n)
+{
+	int i;
+
+	/* a true divide, rcpps is only good to 12 bits */
+	for (i = 0; i + 4 <= n; i += 4)
+		_mm_storeu_ps(y + i, _mm_div_ps(_mm_set1_ps(1.0f), _mm_loadu_ps(x + i)));
+	return i;
+}
+
+__attribute__((target("avx2,fma")))
+static int rcp_avx2(float *y, const float *x, int n)
+{
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(y + i, _mm256_div_ps(_mm256_set1_ps(1.0f),
+						      _mm256_loadu_ps(x + i)));
+	return i;
+}
+
+/*
+ * A lane that got out keeps its z and count from then on, and the vector
+ * carries on until none are left in.
+ */
+static int mandel_sse(float *y, const float *x, float cy, int iter, int n)
+{
+	const __m128 r2 = _mm_set1_ps(MANDEL_R2), one = _mm_set1_ps(1.0f);
+	const __m128 ci = _mm_set1_ps(cy);
+	__m128 cr, zr, zi, zr2, zi2, in, cnt, tr, ti;
+	float k[4], m2[4];
+	int i, j, l;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		cr = _mm_loadu_ps(x + i);
+		zr = zi = cnt = _mm_setzero_ps();
+		in = _mm_cmpeq_ps(cnt, cnt);
+		for (j = 0; j < iter; j++) {
+			zr2 = _mm_mul_ps(zr, zr);
+			zi2 = _mm_mul_ps(zi, zi);
+			in = _mm_and_ps(in, _mm_cmple_ps(_mm_add_ps(zr2, zi2), r2));
+			if (!_mm_movemask_ps(in))
+				break;
+
+			tr = _mm_add_ps(_mm_sub_ps(zr2, zi2), cr);
+			ti = _mm_add_ps(_mm_mul_ps(_mm_add_ps(zr, zr), zi), ci);
+			zr = _mm_or_ps(_mm_and_ps(in, tr), _mm_andnot_ps(in, zr));
+			zi = _mm_or_ps(_mm_and_ps(in, ti), _mm_andnot_ps(in, zi));
+			cnt = _mm_add_ps(cnt, _mm_and_ps(in, one));
+		}
+		_mm_storeu_ps(k, cnt);
+		_mm_storeu_ps(m2, _mm_add_ps(_mm_mul_ps(zr, zr),
+					     _mm_mul_ps(zi, zi)));
+		for (l = 0; l < 4; l++)
+			y[i + l] = mandel_smooth(k[l], m2[l]);
+	}
+	return i;
+}
+
+__attribute__((target("avx2,fma")))
+static int mandel_avx2(float *y, const float *x, float cy, int iter, int n)
+{
+	const __m256 r2 = _mm256_set1_ps(MANDEL_R2), one = _mm256_set1_ps(1.0f);
+	const __m256 ci = _mm256_set1_ps(cy);
+	__m256 cr, zr, zi, zr2, zi2, in, cnt, tr, ti;
+	float k[8], m2[8];
+	int i, j, l;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		cr = _mm256_loadu_ps(x + i);
+		zr = zi = cnt = _mm256_setzero_ps();
+		in = _mm256_cmp_ps(cnt, cnt, _CMP_EQ_OQ);
+		for (j = 0; j < iter; j++) {
+			zr2 = _mm256_mul_ps(zr, zr);
+			zi2 = _mm256_mul_ps(zi, zi);
+			in = _mm256_and_ps(in, _mm256_cmp_ps(_mm256_add_ps(zr2, zi2),
+							     r2, _CMP_LE_OQ));
+			if (!_mm256_movemask_ps(in))
+				break;
+
+			tr = _mm256_add_ps(_mm256_sub_ps(zr2, zi2), cr);
+			ti = _mm256_fmadd_ps(_mm256_add_ps(zr, zr), zi, ci);
+			zr = _mm256_blendv_ps(zr, tr, in);
+			zi = _mm256_blendv_ps(zi, ti, in);
+			cnt = _mm256_add_ps(cnt, _mm256_and_ps(in, one));
+		}
+		_mm256_storeu_ps(k, cnt);
+		_mm256_storeu_ps(m2, _mm256_fmadd_ps(zr, zr,
+						     _mm256_mul_ps(zi, zi)));
+		for (l = 0; l < 8; l++)
+			y[i + l] = mandel_smooth(k[l], m2[l]);
+	}
+	return i;
+}
+
+#else
+
+static int sincos_sse(float *y, const float *x, int n, int op) { return 0; }
+static int sincos_avx2(float *y, const float *x, int n, int op) { return 0; }
+static int powi_sse(float *y, const float *x, int e, int n) { return 0; }
+static int powi_avx2(float *y, const float *x, int e, int n) { return 0; }
+static int rcp_sse(float *y, const float *x, int n) { return 0; }
+static int rcp_avx2(float *y, const float *x, int n) { return 0; }
+static int mandel_sse(float *y, const float *x, float cy, int iter, int n) { return 0; }
+static int mandel_avx2(float *y, const float *x, float cy, int iter, int n) { return 0; }
+
+#endif
+
+/******************************************************************************/
+
+static void sincos_run(float *y, const float *x, int n, int op)
+{
+	int i = 0;
+
+	switch (isa()) {
+	case ISA_AVX2: i = sincos_avx2(y, x, n, op); break;
+	case ISA_SSE:  i = sincos_sse(y, x, n, op); break;
+	}
+	for (; i < n; i++)
+		y[i] = sincos_scalar(x[i], op);
+}
+
+void vsin(float *y, const float *x, int n)
+{
+	sincos_run(y, x, n, OP_SIN);
+}
+
+void vcos(float *y, const float *x, int n)
+{
+	sincos_run(y, x, n, OP_COS);
+}
+
+void vtan(float *y, const float *x, int n)
+{
+	sincos_run(y, x, n, OP_TAN);
+}
+
+#define POWI_MAX	APPROX_POWI_MAX
+
+void vpow(float *y, const float *x, float e, int n)
+{
+	int i = 0;
+
+	if (e != (int)e || fabsf(e) > POWI_MAX) {
+		for (; i < n; i++)
+			y[i] = powf(x[i], e);
+		return;
+	}
+
+	switch (isa()) {
+	case ISA_AVX2: i = powi_avx2(y, x, e, n); break;
+	case ISA_SSE:  i = powi_sse(y, x, e, n); break;
+	}
+	for (; i < n; i++)
+		y[i] = approx_powi(x[i], e);
+}
+
+void vrcp(float *y, const float *x, int n)
+{
+	int i = 0;
+
+	switch (isa()) {
+	case ISA_AVX2: i = rcp_avx2(y, x, n); break;
+	case ISA_SSE:  i = rcp_sse(y, x, n); break;
+	}
+	for (; i < n; i++)
+		y[i] = 1.0f / x[i];
+}
+
+void vmandel(float *y, const float *x, float cy, int iter, int n)
+{
+	int i = 0;
+
+	switch (isa()) {
+	case ISA_AVX2: i = mandel_avx2(y, x, cy, iter, n); break;
+	case ISA_SSE:  i = mandel_sse(y, x, cy, iter, n); break;
+	}
+	for (; i < n; i++)
+		y[i] = mandel_scalar(x[i], cy, iter);
+}
+
+/* plain loops, the compiler vectorizes these well enough */
+
+void vaxpb(float *y, const float *x, float a, float b, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		y[i] = a * x[i] + b;
+}
+
+void vmadd(float *y, const float *x, float a, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		y[i] += a * x[i];
+}
+
+void vmul(float *y, const float *a, const float *b, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		y[i] = a[i] * b[i];
+}
+
+void vadd(float *y, const float *a, const float *b, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		y[i] = a[i] + b[i];
+}
+
+void vdiv(float *y, const float *a, const float *b, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		y[i] = a[i] / b[i];
+}
@@ -0,0 +1,27 @@
+/* Copyright (C) 2020 David Brunecz. Subject to GPL 2.0 */
+
+/*
+ * Batch math over float arrays, y[i] = f(x[i]) for i < n, y may be x.
+ * AVX2 or SSE2 kernels are picked at runtime, VMATH=scalar forces libm.
+ */
+
+void vsin(float *y, const float *x, int n);
+void vcos(float *y, const float *x, int n);
+void vtan(float *y, const float *x, int n);
+void vpow(float *y, const float *x, float e, int n);
+void vrcp(float *y, const float *x, int n);
+
+/*
+ * Escape time of c = x[i] + i cy under z = z^2 + c, at most iter steps,
+ * smoothed to a fraction of a step. NaN for c still bounded after iter.
+ */
+void vmandel(float *y, const float *x, float cy, int iter, int n);
+
+/* the glue between them */
+void vaxpb(float *y, const float *x, float a, float b, int n);	/* a * x + b */
+void vmadd(float *y, const float *x, float a, int n);		/* y += a * x */
+void vmul(float *y, const float *a, const float *b, int n);
+void vadd(float *y, const float *a, const float *b, int n);
+void vdiv(float *y, const float *a, const float *b, int n);
+
+const char *vmath_isa(void);